@@ -123,6 +123,20 @@ def get_var_attrs(cli, var_token, partial_word):
             var_desc = 'one or more worker IDs'
             var_candidates = [str(m['wid']) for m in cli.softnic.list_workers()]
 
+        elif var_token == 'WORKER_ID':
+            var_type = 'wid'
+            var_desc = 'worker ID'
+            var_candidates = [str(m['wid']) for m in cli.softnic.list_workers()]
+
+        elif var_token == 'IDLE_MODE':
+            var_type = 'name'
+            var_desc = 'behavior of an idle worker'
+            var_candidates = ['spin', 'pause', 'sleep']
+
+        elif var_token == '[SAMPLE_ONE_IN]':
+            var_type = 'int'
+            var_desc = 'profile 1 in N task invocations (default 1000)'
+
         elif var_token == 'DRIVER':
             var_type = 'name'
             var_desc = 'name of a port driver'
@@ -161,6 +175,11 @@ def get_var_attrs(cli, var_token, partial_word):
             var_desc = 'one or more port names'
             var_candidates = [p['name'] for p in cli.softnic.list_ports()]
 
+        elif var_token == 'TC':
+            var_type = 'name'
+            var_desc = 'name of a traffic class'
+            var_candidates = [c['name'] for c in cli.softnic.list_tcs()]
+
         elif var_token == 'TC...':
             var_type = 'name+'
             var_desc = 'one or more traffic class names'
@@ -220,7 +239,7 @@ def get_var_attrs(cli, var_token, partial_word):
 #   tail: the rest of input line
 # You can assume that 'line == head + tail'
 def split_var(cli, var_type, line):
-    if var_type in ['name', 'gate', 'confname', 'filename']:
+    if var_type in ['wid', 'name', 'gate', 'int', 'confname', 'filename']:
         pos = line.find(' ')
         if pos == -1:
             head = line
@@ -259,6 +278,12 @@ def bind_var(cli, var_type, line):
                 raise cli.BindError('"wid" must be a positive number')
         val = sorted(list(set(val)))
 
+    elif var_type == 'wid':
+        if head.isdigit():
+            val = int(head)
+        else:
+            raise cli.BindError('"wid" must be a positive number')
+
     elif var_type == 'name':
         if re.match(r'^[_a-zA-Z][\w]*$', val) is None:
             raise cli.BindError('"name" must be [_a-zA-Z][_a-zA-Z0-9]*')
@@ -269,6 +294,12 @@ def bind_var(cli, var_type, line):
         else:
             raise cli.BindError('"gate" must be a positive number')
 
+    elif var_type == 'int':
+        if head.isdigit():
+            val = int(head)
+        else:
+            raise cli.BindError('Expected a positive number')
+
     elif var_type == 'name+':
         val = sorted(list(set(head.split()))) # collect unique items
         for name in val:
@@ -587,13 +618,12 @@ def add_connection(cli, m1, m2, ogate, igate):
     if ogate is None:
         ogate = 0
 
-    # input gate is not supported yet
     if igate is None:
         igate = 0
 
     cli.softnic.pause_all()
     try:
-        cli.softnic.connect_modules(m1, m2, ogate)
+        cli.softnic.connect_modules(m1, m2, ogate, igate)
     finally:
         cli.softnic.resume_all()
 
@@ -622,20 +652,30 @@ def delete_connection(cli, module, ogate):
         cli.softnic.resume_all()
 
 def _show_worker_header(cli):
-    cli.fout.write('  %10s%10s%10s%10s%16s\n' % \
+    cli.fout.write('  %10s%10s%10s%8s%10s%16s%14s\n' % \
             ('Worker ID', 
              'Status', 
              'CPU core', 
+             'Socket',
              '# of TCs',
-             'Deadend pkts'))
+             'Deadend pkts',
+             'Remote pkts'))
 
 def _show_worker(cli, w):
-    cli.fout.write('  %10d%10s%10d%10d%16d\n' % \
+    rx_pkts = w['local_pkts'] + w['remote_pkts']
+    if rx_pkts:
+        remote = '%.1f%%' % (100.0 * w['remote_pkts'] / rx_pkts)
+    else:
+        remote = '-'
+
+    cli.fout.write('  %10d%10s%10d%8d%10d%16d%14s\n' % \
             (w['wid'], 
              'RUNNING' if w['running'] else 'PAUSED', 
              w['core'], 
+             w['socket'],
              w['num_tcs'],
-             w['silent_drops']))
+             w['silent_drops'],
+             remote))
 
 @cmd('show worker', 'Show the status of all worker threads')
 def show_worker_all(cli):
@@ -748,12 +788,26 @@ def show_status(cli):
     else:
         cli.fout.write('(none)\n')
 
+def _cycles_per_pkt(stats):
+    if stats['packets'] > 0:
+        return stats['cycles'] / stats['packets']
+    elif stats['batches'] > 0:
+        return stats['cycles'] / stats['batches']
+    else:
+        return 0
+
 # last_stats: a map of (node name, gateid) -> (timestamp, counter value)
+# field 'profile': annotated with sampled cycles/packet (see 'profile start')
 def _draw_pipeline(cli, field, last_stats = None):
     modules = sorted(cli.softnic.list_modules())
     names = []
     node_labels = {}
 
+    if field == 'profile':
+        profile = {}
+        for m in cli.softnic.get_profile()['modules']:
+            profile[m['name']] = m
+
     for m in modules:
         name = m['name']
         mclass = m['mclass']
@@ -764,6 +818,10 @@ def _draw_pipeline(cli, field, last_stats = None):
         else:
             node_labels[name] += '\\n-'
 
+        if field == 'profile' and name in profile:
+            node_labels[name] += '\\n%d cycles/pkt' % \
+                    _cycles_per_pkt(profile[name])
+
     port_inc_list = []
 
     try:
@@ -779,7 +837,14 @@ def _draw_pipeline(cli, field, last_stats = None):
             gates = cli.softnic.get_module_info(name)['gates']
 
             for gate in gates:
-                if last_stats is not None:
+                if field == 'profile':
+                    # cycles/packet, including all downstream modules
+                    val = 0
+                    if name in profile:
+                        for g in profile[name]['gates']:
+                            if g['gate'] == gate['gate']:
+                                val = _cycles_per_pkt(g)
+                elif last_stats is not None:
                     last_time, last_val = last_stats[(name, gate['gate'])]
                     new_time, new_val = gate['timestamp'], gate[field]
                     last_stats[(name, gate['gate'])] = (new_time, new_val)
@@ -811,6 +876,25 @@ def show_pipeline(cli):
 def show_pipeline_batch(cli):
     cli.fout.write(_draw_pipeline(cli, 'cnt'))
 
+@cmd('show pipeline profile', 
+        'Show the current datapath pipeline with sampled cycles/packet')
+def show_pipeline_profile(cli):
+    cli.fout.write(_draw_pipeline(cli, 'profile'))
+
+@cmd('profile start [SAMPLE_ONE_IN]', 'Start sampled profiling of modules')
+def profile_start(cli, one_in):
+    if one_in is None:
+        one_in = 1000
+
+    if one_in == 0:
+        raise cli.CommandError('Sampling ratio must be positive')
+
+    cli.softnic.enable_profile(one_in)
+
+@cmd('profile stop', 'Stop sampled profiling of modules')
+def profile_stop(cli):
+    cli.softnic.enable_profile(0)
+
 def _group(number):
     s = str(number)
     groups = []
@@ -872,6 +956,18 @@ def _show_module(cli, module):
         cli.fout.write('      %5d: batches %-16d packets %-16d -> %s\n' % \
                 (gate['gate'], gate['cnt'], gate['pkts'], gate['name']))
 
+    if info.get('metadata'):
+        cli.fout.write('    Metadata attributes:\n')
+        for attr in info['metadata']:
+            if attr['offset'] >= 0:
+                offset = str(attr['offset'])
+            else:
+                offset = {-1: 'no writer',
+                          -2: 'no reader',
+                          -3: 'no space'}.get(attr['offset'], 'invalid')
+            cli.fout.write('      %-16s %2dB %-6s offset %s\n' % \
+                    (attr['name'], attr['size'], attr['mode'], offset))
+
     if 'dump' in info:
         cli.fout.write('    Dump:\n')
         cli.fout.write('      %s' % info['dump'])
@@ -1037,7 +1133,8 @@ def _monitor_tcs(cli, *tcs):
         delta = {}
 
         for key in old.keys():
-            delta[key] = (new[key] - old[key]) / sec_diff
+            if key != 'rates':
+                delta[key] = (new[key] - old[key]) / sec_diff
 
         return delta
 
@@ -1078,7 +1175,7 @@ def _monitor_tcs(cli, *tcs):
 
         for stat in arr[1:]:
             for key in total.keys():
-                if key != 'timestamp':
+                if key not in ['timestamp', 'rates']:
                     total[key] += stat[key]
 
         return total
@@ -1098,15 +1195,20 @@ def _monitor_tcs(cli, *tcs):
     last = {}
     now = {}
 
+    # a single request for all TCs, instead of one per TC
+    stats = cli.softnic.get_all_tc_stats()
     for tc in tcs:
-        last[tc] = cli.softnic.get_tc_stats(tc)
+        if tc not in stats:
+            raise cli.CommandError('Traffic class %s does not exist' % tc)
+        last[tc] = stats[tc]
 
     try:
         while True:
             time.sleep(1)
 
+            stats = cli.softnic.get_all_tc_stats()
             for tc in tcs:
-                now[tc] = cli.softnic.get_tc_stats(tc)
+                now[tc] = stats[tc]
 
             print_header(now[tc]['timestamp'])
 
@@ -1126,6 +1228,16 @@ def _monitor_tcs(cli, *tcs):
     except KeyboardInterrupt:
         pass
 
+@cmd('migrate tc TC worker WORKER_ID', 
+     'Move a traffic class to another worker, without pausing workers')
+def migrate_tc(cli, tc, wid):
+    cli.softnic.migrate_tc(tc, wid)
+
+@cmd('set worker WORKER_ID idle IDLE_MODE',
+     'Set whether an idle worker keeps polling, backs off, or sleeps')
+def set_worker_idle(cli, wid, mode):
+    cli.softnic.set_worker_idle(wid, mode)
+
 @cmd('monitor tc', 'Monitor the statistics of all traffic classes')
 def monitor_tc_all(cli):
     _monitor_tcs(cli)
@@ -41,12 +41,12 @@ class Module(object):
             assert False, '%s is not a module or module_tuple' % next_one
         return next_one
 
-    def connect(self, next_mod, gate = 0):
+    def connect(self, next_mod, gate = 0, igate = 0):
         if not isinstance(next_mod, Module):
             assert False, '%s is not a module' % next_mod
 
         #print 'Connecting %s[%d] -> %s' % (self.name, gate, next_mod.name)
-        self.softnic.connect_modules(self.name, next_mod.name, gate)
+        self.softnic.connect_modules(self.name, next_mod.name, gate, igate)
         return next_mod     # for a->b->c syntax
 
     def query(self, arg = None, **kwargs):
@@ -23,7 +23,10 @@ extern const struct global_opts {
 	int foreground;		/* If 1, not daemonized */
 	int kill_existing;	/* If 1, kill existing BESS instance */
 	int print_tc_stats;	/* If 1, print TC stats every second */
+	int throttle_wheel;	/* If 1, use timing wheels for throttled TCs */
 	int debug_mode;		/* If 1, print control messages */
+	int pool_size;		/* packet buffers per socket (0 for default) */
+	const char *sched_test;	/* if set, run the scheduler test and exit */
 } global_opts;
 
 /* The term RX/TX could be very confusing for a virtual switch.
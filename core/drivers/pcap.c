@@ -40,6 +40,9 @@ static struct snobj *pcap_init_port(struct port *p, struct snobj *conf)
 		return snobj_err(ENODEV, "PCAP set to nonblock error: %s", 
 				errbuf);
 
+	/* chains are gathered into tx_pcap_data */
+	p->multiseg = 1;
+
 	log_info("PCAP: open dev %s\n", priv->dev);
 
 	return NULL;
@@ -55,47 +58,6 @@ static void pcap_deinit_port(struct port *p)
 	}
 }
 
-static int pcap_rx_jumbo(struct rte_mempool *mb_pool,
-		struct rte_mbuf *mbuf,
-		const u_char *data,
-		uint16_t data_len)
-{
-	struct rte_mbuf *m = mbuf;
-
-	/* Copy the first segment. */
-	uint16_t len = rte_pktmbuf_tailroom(mbuf);
-
-	rte_memcpy(rte_pktmbuf_append(mbuf, len), data, len);
-	data_len -= len;
-	data += len;
-
-	while (data_len > 0) {
-		/* Allocate next mbuf and point to that. */
-		m->next = rte_pktmbuf_alloc(mb_pool);
-
-		if (unlikely(!m->next))
-			return -1;
-
-		m = m->next;
-
-		/* Headroom is needed for VPort TX */
-
-		m->pkt_len = 0;
-		m->data_len = 0;
-
-		/* Copy next segment. */
-		len = RTE_MIN(rte_pktmbuf_tailroom(m), data_len);
-		rte_memcpy(rte_pktmbuf_append(m, len), data, len);
-
-		mbuf->nb_segs++;
-		data_len -= len;
-		data += len;
-	}
-
-	return mbuf->nb_segs;
-}
-
-
 static int 
 pcap_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
 {
@@ -120,19 +82,13 @@ pcap_recv_pkts(struct port *p, queue_t qid, snb_array_t pkts, int cnt)
 			rte_memcpy(rte_pktmbuf_append(&sbuf->mbuf, header.caplen), packet,
 					header.caplen);
 		} else {
-			/* FIXME: no support for chained mbuf for now */
-			snb_free(sbuf);
-			break;
-			
-			/* Try read jumbo frame into multi mbufs. */
-			if (unlikely(pcap_rx_jumbo(sbuf->mbuf.pool,
-							&sbuf->mbuf,
-							packet,
-							header.caplen) == -1)) {
-				//drop all the mbufs.
+			/* jumbo frame. read into chained mbufs */
+			if (unlikely(snb_extend(sbuf, header.caplen) < 0)) {
 				snb_free(sbuf);
 				break;
 			}
+
+			snb_write(sbuf, 0, header.caplen, packet);
 		}
 
 		pkts[recv_cnt] = sbuf;
@@ -188,6 +188,10 @@ static struct snobj *pmd_init_port(struct port *p, struct snobj *conf)
 	int num_rxq = p->num_queues[PACKET_DIR_INC];
 
 	struct snobj *err;
+
+	int mtu;
+	int multiseg = 0;
+	int sid;
 	
 	int ret;
 
@@ -205,28 +209,62 @@ static struct snobj *pmd_init_port(struct port *p, struct snobj *conf)
 	 * with minor tweaks */
 	rte_eth_dev_info_get(port_id, &dev_info);
 
+	mtu = snobj_eval_int(conf, "mtu");
+	if (mtu) {
+		uint32_t max_len = mtu + ETHER_HDR_LEN + ETHER_CRC_LEN;
+
+		if (mtu < ETHER_MIN_MTU || 
+				max_len > ETHER_MAX_JUMBO_FRAME_LEN ||
+				max_len > dev_info.max_rx_pktlen)
+			return snobj_err(EINVAL, "Invalid MTU %d " \
+					"(max frame size: %u)", mtu, 
+					dev_info.max_rx_pktlen);
+
+		/* Frames larger than a snbuf are received/sent as
+		 * chained snbufs */
+		if (mtu > ETHER_MTU) {
+			eth_conf.rxmode.jumbo_frame = 1;
+			eth_conf.rxmode.max_rx_pkt_len = max_len;
+			eth_conf.rxmode.enable_scatter = 
+				(max_len > SNBUF_DATA);
+			multiseg = 1;
+		}
+	}
+
 	eth_rxconf = dev_info.default_rxconf;
 	eth_rxconf.rx_drop_en = 1;
 
 	eth_txconf = dev_info.default_txconf;
 	eth_txconf.txq_flags = ETH_TXQ_FLAGS_NOVLANOFFL |
-			ETH_TXQ_FLAGS_NOMULTSEGS * (1 - SN_TSO_SG) | 
+			ETH_TXQ_FLAGS_NOMULTSEGS * (1 - (SN_TSO_SG | multiseg)) | 
 			ETH_TXQ_FLAGS_NOXSUMS * (1 - SN_HW_TXCSUM);
 
+	p->multiseg = SN_TSO_SG | multiseg;
+
 	ret = rte_eth_dev_configure(port_id,
 				    num_rxq, num_txq, &eth_conf);
 	if (ret != 0) 
 		return snobj_err(-ret, "rte_eth_dev_configure() failed");
 
+	if (mtu) {
+		ret = rte_eth_dev_set_mtu(port_id, mtu);
+		if (ret != 0 && ret != -ENOTSUP)
+			return snobj_err(-ret, "rte_eth_dev_set_mtu() failed");
+	}
+
 	rte_eth_promiscuous_enable(port_id);
 
-	for (i = 0; i < num_rxq; i++) {
-		int sid = rte_eth_dev_socket_id(port_id);
+	/* Descriptor rings and RX buffers are allocated on the socket of
+	 * the device, so that the NIC does not DMA across sockets.
+	 * Workers on the other socket will see them as remote packets. */
+	sid = rte_eth_dev_socket_id(port_id);
 
-		/* if socket_id is invalid, set to 0 */
-		if (sid < 0 || sid > RTE_MAX_NUMA_NODES)
-			sid = 0;
+	/* if socket_id is invalid (or has no pool), set to 0 */
+	if (sid < 0 || sid >= RTE_MAX_NUMA_NODES || 
+			!get_pframe_pool_socket(sid))
+		sid = 0;
 
+	for (i = 0; i < num_rxq; i++) {
 		ret = rte_eth_rx_queue_setup(port_id, i, 
 					     p->queue_size[PACKET_DIR_INC],
 					     sid, &eth_rxconf,
@@ -237,8 +275,6 @@ static struct snobj *pmd_init_port(struct port *p, struct snobj *conf)
 	}
 
 	for (i = 0; i < num_txq; i++) {
-		int sid = 0;		/* XXX */
-
 		ret = rte_eth_tx_queue_setup(port_id, i,
 					     p->queue_size[PACKET_DIR_OUT],
 					     sid, &eth_txconf);
@@ -18,6 +18,7 @@
 #include "worker.h"
 #include "driver.h"
 #include "log.h"
+#include "tc.h"
 
 const struct global_opts global_opts;
 static struct global_opts *opts = (struct global_opts *)&global_opts;
@@ -25,7 +26,8 @@ static struct global_opts *opts = (struct global_opts *)&global_opts;
 static void print_usage(char *exec_name)
 {
 	log_err("Usage: %s" \
-		" [-t] [-c <core list>] [-p <port>] [-f] [-k] [-d]\n\n",
+		" [-t] [-c <core list>] [-p <port>] [-m <pkts>] [-f] [-k] [-s]"
+		" [-w] [-d] [-b <test>]\n\n",
 		exec_name);
 
 	log_err("  %-16s Dump the size of internal data structures\n", 
@@ -35,14 +37,22 @@ static void print_usage(char *exec_name)
 	log_err("  %-16s Specifies the TCP port on which SoftNIC" \
 			" listens for controller connections\n",
 			"-p <port>");
+	log_err("  %-16s Packet buffers per socket (default: 512K). " \
+			"Smaller pools start faster\n",
+			"-m <pkts>");
 	log_err("  %-16s Run BESS in foreground mode (for developers)\n",
 			"-f");
 	log_err("  %-16s Kill existing BESS instance, if any\n",
 			"-k");
 	log_err("  %-16s Show TC statistics every second\n",
 			"-s");
+	log_err("  %-16s Use timing wheels for throttled TCs\n",
+			"-w");
 	log_err("  %-16s Run BESS in debug mode (with debug log messages)\n",
 			"-d");
+	log_err("  %-16s Run a scheduler test/benchmark and exit " \
+			"(alloc, perf, edf, or backpressure)\n",
+			"-b <test>");
 
 	exit(2);
 }
@@ -55,7 +65,7 @@ static void parse_args(int argc, char **argv)
 
 	num_workers = 0;
 
-	while ((c = getopt(argc, argv, ":tc:p:fksd")) != -1) {
+	while ((c = getopt(argc, argv, ":tc:p:m:fkswdb:")) != -1) {
 		switch (c) {
 		case 't':
 			dump_types();
@@ -66,6 +76,14 @@ static void parse_args(int argc, char **argv)
 			sscanf(optarg, "%hu", &opts->port);
 			break;
 
+		case 'm':
+			sscanf(optarg, "%d", &opts->pool_size);
+			if (opts->pool_size < 1024) {
+				log_err("-m must be at least 1024\n");
+				print_usage(argv[0]);
+			}
+			break;
+
 		case 'f':
 			opts->foreground = 1;
 			break;
@@ -78,10 +96,19 @@ static void parse_args(int argc, char **argv)
 			opts->print_tc_stats = 1;
 			break;
 
+		case 'w':
+			opts->throttle_wheel = 1;
+			break;
+
 		case 'd':
 			opts->debug_mode = 1;
 			break;
 
+		case 'b':
+			opts->sched_test = optarg;
+			opts->foreground = 1;
+			break;
+
 		case ':':
 			log_err("argument is required for -%c\n", optopt);
 			print_usage(argv[0]);
@@ -314,6 +341,16 @@ int main(int argc, char **argv)
 	start_logger();
 
 	init_dpdk(argv[0]);
+
+	if (opts->sched_test) {
+		if (sched_test(opts->sched_test) < 0) {
+			log_err("Unknown scheduler test '%s'\n", 
+					opts->sched_test);
+			print_usage(argv[0]);
+		}
+		exit(EXIT_SUCCESS);
+	}
+
 	init_mempool();
 	init_drivers();
 
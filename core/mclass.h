@@ -49,11 +49,15 @@ struct mclass
 	/* Optional: cleanup internal state */
 	void (*deinit)(struct module *m);
 
-#if 0
-	/* FIXME */
-	/* Optional: Invoked on every worker */
-	void (*init_worker)(struct module *m);
-#endif
+	/* Optional: the size of per-worker private data (get_worker_priv()).
+	 *   One region is allocated for each worker on its socket,
+	 *   cache line aligned and zero initialized. */
+	uint32_t priv_worker_size;
+
+	/* Optional: initialize per-worker private data. Invoked by the master
+	 *   for each worker, right after init() and whenever a new worker
+	 *   is launched. The worker is not running at the time. */
+	void (*init_worker)(struct module *m, int wid);
 
 	/* Optional: module-specific query interface.
 	 * q is not NULL (will be snobj_nil if not given by user) */
@@ -0,0 +1,437 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "module.h"
+#include "namespace.h"
+#include "log.h"
+#include "metadata.h"
+
+/* the part of the metadata area available for attributes */
+#define MT_TOTAL_SIZE	(SNBUF_METADATA - \
+		(offsetof(struct snbuf, _metadata_buf) - \
+		 offsetof(struct snbuf, _metadata)))
+
+/* A scope component is the set of modules where an attribute is alive,
+ * from its writer(s) to the last reader(s) along the graph.
+ * Components of the same attribute that share a module are merged,
+ * since the module can only have a single offset for the attribute. */
+struct scope_component {
+	const char *name;
+	int size;
+	uint8_t *in_scope;	/* indexed by mt_idx */
+	uint8_t *covered;	/* in scope, and all paths to it pass a writer */
+	int root;		/* union-find */
+	mt_offset_t offset;
+};
+
+enum {
+	UNVISITED,
+	VISITING,
+	DEAD,		/* no reader downstream */
+	ALIVE,
+};
+
+static struct module **modules;
+static int num_modules;
+static uint8_t *states;		/* per module, for each traversal */
+
+static struct scope_component *comps;
+static int num_comps;
+
+int add_metadata_attr(struct module *m, const char *name, int size,
+		enum mt_access_mode mode)
+{
+	int n = m->num_attrs;
+
+	if (n >= MAX_ATTRS_PER_MODULE)
+		return -ENOSPC;
+
+	if (!name || !name[0] || strlen(name) >= MAX_ATTR_NAME_LEN)
+		return -EINVAL;
+
+	if (size < 1 || size > MAX_ATTR_SIZE)
+		return -EINVAL;
+
+	if (mode != MT_READ && mode != MT_WRITE && mode != MT_UPDATE)
+		return -EINVAL;
+
+	for (int i = 0; i < n; i++)
+		if (strcmp(m->attrs[i].name, name) == 0)
+			return -EEXIST;
+
+	strcpy(m->attrs[n].name, name);
+	m->attrs[n].size = size;
+	m->attrs[n].mode = mode;
+
+	/* until the module is connected */
+	m->attr_offsets[n] = (mode == MT_WRITE) ?
+			MT_OFFSET_NOWRITE : MT_OFFSET_NOREAD;
+
+	m->num_attrs++;
+
+	return n;
+}
+
+static int find_attr(const struct module *m, const char *name, int size)
+{
+	for (int i = 0; i < m->num_attrs; i++)
+		if (m->attrs[i].size == size &&
+				strcmp(m->attrs[i].name, name) == 0)
+			return i;
+
+	return -1;
+}
+
+static int trace_attr(struct scope_component *c, struct module *m);
+
+static int trace_downstream(struct scope_component *c, struct module *m)
+{
+	int alive = 0;
+
+	for (gate_t i = 0; i < m->allocated_gates; i++)
+		if (m->gates[i].m)
+			alive |= trace_attr(c, m->gates[i].m);
+
+	return alive;
+}
+
+/* Returns 1 if the attribute is alive at m (read by m or downstream) */
+static int trace_attr(struct scope_component *c, struct module *m)
+{
+	int idx = m->mt_idx;
+	int alive = 0;
+	int id;
+
+	switch (states[idx]) {
+	case VISITING:
+		return 1;	/* cycle. conservatively assume alive */
+	case DEAD:
+		return 0;
+	case ALIVE:
+		return 1;
+	}
+
+	id = find_attr(m, c->name, c->size);
+	if (id >= 0) {
+		/* overwritten. it begins another component */
+		if (m->attrs[id].mode == MT_WRITE) {
+			states[idx] = DEAD;
+			return 0;
+		}
+
+		alive = 1;
+	}
+
+	states[idx] = VISITING;
+	alive |= trace_downstream(c, m);
+	states[idx] = alive ? ALIVE : DEAD;
+
+	if (alive)
+		c->in_scope[idx] = 1;
+
+	return alive;
+}
+
+static int collect_modules(void)
+{
+	struct ns_iter iter;
+	struct module *m;
+
+	num_modules = 0;
+
+	ns_init_iterator(&iter, NS_TYPE_MODULE);
+	while ((m = (struct module *)ns_next(&iter)) != NULL)
+		num_modules++;
+	ns_release_iterator(&iter);
+
+	modules = malloc(sizeof(struct module *) * (num_modules + 1));
+	states = malloc(num_modules + 1);
+	if (!modules || !states)
+		return -ENOMEM;
+
+	num_modules = 0;
+
+	ns_init_iterator(&iter, NS_TYPE_MODULE);
+	while ((m = (struct module *)ns_next(&iter)) != NULL) {
+		m->mt_idx = num_modules;
+		modules[num_modules++] = m;
+	}
+	ns_release_iterator(&iter);
+
+	return 0;
+}
+
+/* one component for each (live) writer */
+static int build_components(void)
+{
+	int max_comps = 0;
+
+	for (int i = 0; i < num_modules; i++)
+		max_comps += modules[i]->num_attrs;
+
+	comps = calloc(max_comps + 1, sizeof(struct scope_component));
+	if (!comps)
+		return -ENOMEM;
+
+	num_comps = 0;
+
+	for (int i = 0; i < num_modules; i++) {
+		struct module *m = modules[i];
+
+		for (int j = 0; j < m->num_attrs; j++) {
+			struct scope_component *c = &comps[num_comps];
+
+			if (m->attrs[j].mode != MT_WRITE)
+				continue;
+
+			c->name = m->attrs[j].name;
+			c->size = m->attrs[j].size;
+			c->in_scope = calloc(num_modules, 1);
+			if (!c->in_scope)
+				return -ENOMEM;
+
+			memset(states, UNVISITED, num_modules);
+			states[i] = VISITING;
+
+			if (!trace_downstream(c, m)) {
+				free(c->in_scope);
+				c->in_scope = NULL;
+				continue;
+			}
+
+			c->in_scope[i] = 1;
+			c->root = num_comps++;
+		}
+	}
+
+	return 0;
+}
+
+static int share_module(const struct scope_component *a,
+		const struct scope_component *b)
+{
+	for (int i = 0; i < num_modules; i++)
+		if (a->in_scope[i] && b->in_scope[i])
+			return 1;
+
+	return 0;
+}
+
+static int find_root(int i)
+{
+	while (comps[i].root != i)
+		i = comps[i].root;
+
+	return i;
+}
+
+static void merge_components(void)
+{
+	for (int i = 0; i < num_comps; i++) {
+		for (int j = i + 1; j < num_comps; j++) {
+			struct scope_component *a = &comps[i];
+			struct scope_component *b = &comps[j];
+			int ra;
+			int rb;
+
+			if (a->size != b->size || strcmp(a->name, b->name))
+				continue;
+
+			if (!share_module(a, b))
+				continue;
+
+			ra = find_root(i);
+			rb = find_root(j);
+			if (ra != rb)
+				comps[rb].root = ra;
+		}
+	}
+
+	/* fold the scopes into the roots */
+	for (int i = 0; i < num_comps; i++) {
+		int r = find_root(i);
+
+		comps[i].root = r;
+		if (r == i)
+			continue;
+
+		for (int k = 0; k < num_modules; k++)
+			comps[r].in_scope[k] |= comps[i].in_scope[k];
+	}
+}
+
+static int is_upstream(const struct module *u, const struct module *m)
+{
+	for (gate_t i = 0; i < u->allocated_gates; i++)
+		if (u->gates[i].m == m)
+			return 1;
+
+	return 0;
+}
+
+/* Packets from a module out of scope (e.g., a PortInc merged in) carry
+ * stale data in the attribute. Modules reachable from them are uncovered */
+static int find_covered(struct scope_component *c)
+{
+	int changed;
+
+	c->covered = malloc(num_modules);
+	if (!c->covered)
+		return -ENOMEM;
+
+	memcpy(c->covered, c->in_scope, num_modules);
+
+	do {
+		changed = 0;
+
+		for (int i = 0; i < num_modules; i++) {
+			int id;
+
+			if (!c->covered[i])
+				continue;
+
+			id = find_attr(modules[i], c->name, c->size);
+			if (id >= 0 && modules[i]->attrs[id].mode == MT_WRITE)
+				continue;
+
+			for (int j = 0; j < num_modules; j++) {
+				if (c->covered[j] ||
+						!is_upstream(modules[j], modules[i]))
+					continue;
+
+				c->covered[i] = 0;
+				changed = 1;
+				break;
+			}
+		}
+	} while (changed);
+
+	return 0;
+}
+
+static int overlapping(int off1, int size1, int off2, int size2)
+{
+	return off1 < off2 + size2 && off2 < off1 + size1;
+}
+
+static mt_offset_t place_component(int idx)
+{
+	struct scope_component *c = &comps[idx];
+	int align = 1;
+
+	while (align * 2 <= c->size && align < 8)
+		align *= 2;
+
+	for (int off = 0; off + c->size <= MT_TOTAL_SIZE; off += align) {
+		int conflict = 0;
+
+		for (int i = 0; i < num_comps && !conflict; i++) {
+			struct scope_component *other = &comps[i];
+
+			if (other->root != i || i == idx)
+				continue;
+
+			if (!is_valid_offset(other->offset))
+				continue;
+
+			if (overlapping(off, c->size,
+					other->offset, other->size) &&
+					share_module(c, other))
+				conflict = 1;
+		}
+
+		if (!conflict)
+			return off;
+	}
+
+	log_warn("metadata: out of space for attribute '%s' (%d bytes)\n",
+			c->name, c->size);
+
+	return MT_OFFSET_NOSPACE;
+}
+
+static void assign_offsets(void)
+{
+	for (int i = 0; i < num_comps; i++)
+		comps[i].offset = MT_OFFSET_NOSPACE;
+
+	/* larger ones first */
+	for (int size = MAX_ATTR_SIZE; size > 0; size--)
+		for (int i = 0; i < num_comps; i++)
+			if (comps[i].root == i && comps[i].size == size)
+				comps[i].offset = place_component(i);
+
+	for (int i = 0; i < num_modules; i++) {
+		struct module *m = modules[i];
+
+		for (int j = 0; j < m->num_attrs; j++) {
+			const struct mt_attr *attr = &m->attrs[j];
+
+			m->attr_offsets[j] = (attr->mode == MT_WRITE) ?
+					MT_OFFSET_NOWRITE : MT_OFFSET_NOREAD;
+
+			for (int k = 0; k < num_comps; k++) {
+				struct scope_component *c = &comps[k];
+
+				if (c->root != k || !c->in_scope[i])
+					continue;
+
+				if (c->size != attr->size ||
+						strcmp(c->name, attr->name))
+					continue;
+
+				if (attr->mode != MT_WRITE && !c->covered[i]) {
+					log_info("metadata: '%s' is not written "
+						"on every path to %s\n",
+						attr->name, m->name);
+					break;
+				}
+
+				m->attr_offsets[j] = c->offset;
+				break;
+			}
+		}
+	}
+}
+
+static void cleanup(void)
+{
+	for (int i = 0; i < num_comps; i++) {
+		free(comps[i].in_scope);
+		free(comps[i].covered);
+	}
+
+	free(comps);
+	free(states);
+	free(modules);
+
+	comps = NULL;
+	states = NULL;
+	modules = NULL;
+	num_comps = 0;
+	num_modules = 0;
+}
+
+void compute_metadata_offsets(void)
+{
+	if (collect_modules() || build_components()) {
+		log_err("metadata: out of memory\n");
+		cleanup();
+		return;
+	}
+
+	merge_components();
+
+	for (int i = 0; i < num_comps; i++) {
+		if (comps[i].root == i && find_covered(&comps[i])) {
+			log_err("metadata: out of memory\n");
+			cleanup();
+			return;
+		}
+	}
+
+	assign_offsets();
+
+	cleanup();
+}
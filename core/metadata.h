@@ -0,0 +1,81 @@
+#ifndef _METADATA_H_
+#define _METADATA_H_
+
+#include <stdint.h>
+
+#include "snbuf.h"
+
+/* Per-packet metadata attributes.
+ *
+ * Modules declare the attributes they read and/or write, by name and size,
+ * with add_metadata_attr() in their init(). Whenever the pipeline changes,
+ * compute_metadata_offsets() places each attribute in the metadata area of
+ * snbufs, so that:
+ *   - a reader sees the value written by its upstream writer(s)
+ *   - attributes alive at the same module do not overlap.
+ *     Attributes whose lifetimes (writer -> last reader, along the graph)
+ *     do not overlap may share the same bytes.
+ * Modules then access attributes with a per-module offset lookup:
+ * 	get_attr(m, id, pkt, type) / set_attr(m, id, pkt, type, val) */
+
+#define MAX_ATTRS_PER_MODULE	16
+#define MAX_ATTR_NAME_LEN	32
+#define MAX_ATTR_SIZE		32
+
+enum mt_access_mode {
+	MT_READ,
+	MT_WRITE,
+	MT_UPDATE,	/* read and write */
+};
+
+struct mt_attr {
+	char name[MAX_ATTR_NAME_LEN];
+	int size;
+	enum mt_access_mode mode;
+};
+
+typedef int16_t mt_offset_t;
+
+/* Invalid offsets. Writes are ignored, reads return zero */
+#define MT_OFFSET_NOREAD	-1	/* not written on every path to here */
+#define MT_OFFSET_NOWRITE	-2	/* no downstream module reads it */
+#define MT_OFFSET_NOSPACE	-3	/* out of metadata space */
+
+struct module;
+
+/* Returns the attribute ID (per module), or -errno */
+int add_metadata_attr(struct module *m, const char *name, int size,
+		enum mt_access_mode mode);
+
+/* Workers must be paused */
+void compute_metadata_offsets(void);
+
+static inline int is_valid_offset(mt_offset_t offset)
+{
+	return offset >= 0;
+}
+
+static inline void *_ptr_attr_with_offset(mt_offset_t offset,
+		struct snbuf *pkt)
+{
+	return pkt->_metadata_buf + offset;
+}
+
+#define get_attr_with_offset(offset, pkt, type) \
+	(is_valid_offset(offset) ? \
+		*(type *)_ptr_attr_with_offset(offset, pkt) : (type){0})
+
+#define set_attr_with_offset(offset, pkt, type, val) \
+	do { \
+		mt_offset_t _offset = (offset); \
+		if (is_valid_offset(_offset)) \
+			*(type *)_ptr_attr_with_offset(_offset, pkt) = (val); \
+	} while (0)
+
+#define get_attr(m, attr_id, pkt, type) \
+	get_attr_with_offset((m)->attr_offsets[attr_id], pkt, type)
+
+#define set_attr(m, attr_id, pkt, type, val) \
+	set_attr_with_offset((m)->attr_offsets[attr_id], pkt, type, val)
+
+#endif
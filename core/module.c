@@ -131,6 +131,116 @@ static void destroy_all_tasks(struct module *m)
 	}
 }
 
+#if TRACK_GATES
+static struct gate_stats *alloc_gate_stats(int wid, gate_t size)
+{
+	int socket = workers[wid] ? workers[wid]->socket : SOCKET_ID_ANY;
+
+	return rte_zmalloc_socket("gate_stats",
+			sizeof(struct gate_stats) * size, 0, socket);
+}
+
+/* Resizes the counter arrays of all workers, which have been launched ever,
+ * to new_size. The old counters are preserved. Workers must be paused */
+static int grow_gate_stats(struct module *m, gate_t new_size)
+{
+	struct gate_stats *new_stats[MAX_WORKERS] = {NULL};
+	gate_t old_size = m->allocated_gates;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		if (!is_worker_active(wid) && !m->gate_stats[wid])
+			continue;
+
+		new_stats[wid] = alloc_gate_stats(wid, new_size);
+		if (!new_stats[wid])
+			goto fail;
+	}
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		if (!new_stats[wid])
+			continue;
+
+		if (m->gate_stats[wid]) {
+			rte_memcpy(new_stats[wid], m->gate_stats[wid],
+					sizeof(struct gate_stats) * old_size);
+			rte_free(m->gate_stats[wid]);
+		}
+
+		m->gate_stats[wid] = new_stats[wid];
+	}
+
+	return 0;
+
+fail:
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		rte_free(new_stats[wid]);
+
+	return -ENOMEM;
+}
+
+void get_gate_stats(const struct module *m, gate_t ogate,
+		struct gate_stats *stats)
+{
+	stats->cnt = 0;
+	stats->pkts = 0;
+
+	if (ogate >= m->allocated_gates)
+		return;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		const struct gate_stats *s = m->gate_stats[wid];
+
+		if (!s)
+			continue;
+
+		stats->cnt += s[ogate].cnt;
+		stats->pkts += s[ogate].pkts;
+	}
+}
+#endif
+
+static int init_worker_priv(struct module *m, int wid)
+{
+	const struct mclass *mclass = m->mclass;
+
+#if TRACK_GATES
+	if (m->allocated_gates && !m->gate_stats[wid]) {
+		m->gate_stats[wid] = alloc_gate_stats(wid, m->allocated_gates);
+		if (!m->gate_stats[wid])
+			return -ENOMEM;
+	}
+#endif
+
+	/* already initialized in the previous life of the worker */
+	if (m->worker_priv[wid])
+		return 0;
+
+	if (mclass->priv_worker_size) {
+		m->worker_priv[wid] = rte_zmalloc_socket("worker_priv",
+				mclass->priv_worker_size, 0,
+				workers[wid]->socket);
+		if (!m->worker_priv[wid])
+			return -ENOMEM;
+	}
+
+	if (mclass->init_worker)
+		mclass->init_worker(m, wid);
+
+	return 0;
+}
+
+static void free_worker_priv(struct module *m)
+{
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		rte_free(m->worker_priv[wid]);
+		m->worker_priv[wid] = NULL;
+#if TRACK_GATES
+		rte_free(m->gate_stats[wid]);
+		m->gate_stats[wid] = NULL;
+#endif
+	}
+}
+
 /* returns a pointer to the created module.
  * if error, returns NULL and *perr is set */
 struct module *create_module(const char *name, 
@@ -189,19 +299,36 @@ struct module *create_module(const char *name,
 			goto fail;
 	}
 
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		if (!is_worker_active(wid))
+			continue;
+
+		ret = init_worker_priv(m, wid);
+		if (ret != 0) {
+			*perr = snobj_errno(-ret);
+			goto fail_deinit;
+		}
+	}
+
 	ret = register_module(m);
 	if (ret != 0) {
 		*perr = snobj_errno(-ret);
-		goto fail;
+		goto fail_deinit;
 	}
 
 	return m;
 
+fail_deinit:
+	/* init() has succeeded. e.g., it may have started a thread */
+	if (mclass->deinit)
+		mclass->deinit(m);
+
 fail:
 	if (m) {
 		destroy_all_tasks(m);
 		rte_free(m->name);
 		rte_free(m->gates);
+		free_worker_priv(m);
 	}
 
 	rte_free(m);
@@ -213,6 +340,9 @@ void destroy_module(struct module *m)
 {
 	struct ns_iter iter;
 
+	/* sampled records may point to this module */
+	profile_discard();
+
 	if (m->mclass->deinit)
 		m->mclass->deinit(m);
 
@@ -239,6 +369,7 @@ void destroy_module(struct module *m)
 
 	rte_free(m->name);
 	rte_free(m->gates);
+	free_worker_priv(m);
 	rte_free(m);
 }
 
@@ -259,6 +390,12 @@ static int grow_gates(struct module *m, gate_t gate)
 			new_size *= 2;
 	}
 
+#if TRACK_GATES
+	if (grow_gate_stats(m, new_size))
+		return -ENOMEM;
+#endif
+
+	/* the grown counter arrays are harmless even if this fails */
 	new_gates = rte_realloc(m->gates, 
 			sizeof(struct output_gate) * new_size, 0);
 	if (!new_gates)
@@ -280,22 +417,27 @@ static int grow_gates(struct module *m, gate_t gate)
 }
 
 /* returns -errno if fails */
-int connect_modules(struct module *m1, gate_t gate, struct module *m2)
+int connect_modules(struct module *m1, gate_t ogate, 
+		struct module *m2, gate_t igate)
 {
 	if (!m2->mclass->process_batch)
 		return -EINVAL;
 
-	if (gate >= m1->allocated_gates) {
-		int ret = grow_gates(m1, gate);
+	if (igate >= MAX_INPUT_GATES)
+		return -EINVAL;
+
+	if (ogate >= m1->allocated_gates) {
+		int ret = grow_gates(m1, ogate);
 		if (ret)
 			return ret;
 	}
 
-	if (m1->gates[gate].m)
+	if (m1->gates[ogate].m)
 		return -EBUSY;
 
-	m1->gates[gate].m = m2;
-	m1->gates[gate].f = m2->mclass->process_batch;
+	m1->gates[ogate].m = m2;
+	m1->gates[ogate].f = m2->mclass->process_batch;
+	m1->gates[ogate].igate = igate;
 
 	return 0;
 }
@@ -308,6 +450,7 @@ int disconnect_modules(struct module *m, gate_t gate)
 	/* no error even if the gate is already pointing to a dead end */
 	m->gates[gate].m = NULL;
 	m->gates[gate].f = deadend;
+	m->gates[gate].igate = 0;
 
 	return 0;
 }
@@ -342,19 +485,22 @@ void add_next_module(struct module *prev, struct module *next, void *arg)
 }
 #endif
 
-#if 0
-void init_module_worker()
+int init_module_worker(int wid)
 {
-	int i;
-
-	for (i = 0; i < num_modules; i++) {
-		struct module *mod = modules[i];
+	struct ns_iter iter;
+	struct module *m;
+	int ret = 0;
 
-		if (mod->mclass->init_worker)
-			mod->mclass->init_worker(mod);
+	ns_init_iterator(&iter, NS_TYPE_MODULE);
+	while ((m = (struct module *)ns_next(&iter)) != NULL) {
+		ret = init_worker_priv(m, wid);
+		if (ret)
+			break;
 	}
+	ns_release_iterator(&iter);
+
+	return ret;
 }
-#endif
 
 #if SN_TRACE_MODULES
 #define MAX_TRACE_DEPTH		32
@@ -20,6 +20,8 @@
 #include "snbuf.h"
 #include "worker.h"
 #include "snobj.h"
+#include "profile.h"
+#include "metadata.h"
 
 #define MAX_TASKS_PER_MODULE	32
 
@@ -34,20 +36,34 @@ typedef uint16_t gate_t;
 
 ct_assert(MAX_OUTPUT_GATES < INVALID_GATE);
 
+/* Input gates only tell modules where a batch came from. 
+ * Modules that do not care can ignore them. */
+#define MAX_INPUT_GATES		8192
+
 #define TRACK_GATES		1
 #define TCPDUMP_GATES		1
+#define PROFILE_MODULES		1	/* see profile.h */
 
-struct output_gate {
-	struct module *m;
-	proc_func_t f;		/* m->mclass->process_batch() or deadend() */
 #if TRACK_GATES
+/* Kept per worker, so that workers feeding the same module
+ * do not bounce the cache lines of the shared gates */
+struct gate_stats {
 	uint64_t cnt;
 	uint64_t pkts;
+};
 #endif
+
+struct output_gate {
+	struct module *m;
+	proc_func_t f;		/* m->mclass->process_batch() or deadend() */
+	gate_t igate;		/* input gate of m (visible as ctx.igate) */
 #if TCPDUMP_GATES
 	uint32_t tcpdump;
 	int fifo_fd;
 #endif
+#if PROFILE_MODULES
+	struct profile_stats prof;	/* aggregated by the master */
+#endif
 };
 
 /* This struct is shared across workers */
@@ -59,10 +75,29 @@ struct module {
 
 	struct task *tasks[MAX_TASKS_PER_MODULE];
 
+#if PROFILE_MODULES
+	struct profile_stats prof;	/* excluding downstream modules */
+#endif
+
+	/* per-packet metadata attributes. see metadata.h */
+	int num_attrs;
+	struct mt_attr attrs[MAX_ATTRS_PER_MODULE];
+	int mt_idx;		/* used by compute_metadata_offsets() */
+
 	/* frequently access fields should be below */
 	gate_t allocated_gates;
 	struct output_gate *gates;
 
+	mt_offset_t attr_offsets[MAX_ATTRS_PER_MODULE];
+
+	/* see mclass.priv_worker_size. NULL for never-launched workers */
+	void *worker_priv[MAX_WORKERS];
+
+#if TRACK_GATES
+	/* [wid][ogate], on the worker's socket. see get_gate_stats() */
+	struct gate_stats *gate_stats[MAX_WORKERS];
+#endif
+
 	/* Some private data for this module instance begins at this marker. 
 	 * (this is poor person's class inheritance in C language)
 	 * The 'struct module' object will be allocated with enough tail room
@@ -71,8 +106,9 @@ struct module {
 	 * to save a few cycles without indirect memory access.
 	 *
 	 * Note: this is shared across all workers. Ensuring thread safety 
-	 * and/or managing per-worker data is each module's responsibility. */
-	void *priv[0]; 	
+	 * is each module's responsibility. Mutable per-worker state should
+	 * go to the per-worker private data instead (get_worker_priv()). */
+	void *priv[0] __cacheline_aligned;
 };
 
 static inline void *get_priv(struct module *m) 
@@ -85,6 +121,23 @@ static inline const void *get_priv_const(const struct module *m)
 	return (const void *)(m + 1);
 }
 
+/* Per-worker private data of the calling worker */
+static inline void *get_worker_priv(struct module *m)
+{
+	return m->worker_priv[ctx.wid];
+}
+
+/* Iterates over the per-worker private data of all (ever launched) workers,
+ * e.g., for the master to aggregate statistics in query():
+ *
+ * 	for_each_worker_priv(m, wid, wpriv)
+ * 		total += wpriv->pkts;
+ *
+ * Values may be updated by running workers meanwhile. */
+#define for_each_worker_priv(m, wid, wpriv) \
+	for ((wid) = 0; (wid) < MAX_WORKERS; (wid)++) \
+		if (((wpriv) = (m)->worker_priv[wid]) == NULL) {} else
+
 task_id_t register_task(struct module *m, void *arg);
 void unregister_task(struct module *m, task_id_t tid);
 
@@ -99,13 +152,21 @@ struct module *create_module(const char *name,
 
 void destroy_module(struct module *m);
 
-int connect_modules(struct module *m1, gate_t gate, struct module *m2);
+int connect_modules(struct module *m1, gate_t ogate, 
+		struct module *m2, gate_t igate);
 int disconnect_modules(struct module *m, gate_t gate);
 		
 void deadend(struct module *m, struct pkt_batch *batch);
 
-/* run all per-thread initializers */
-void init_module_worker(void);
+#if TRACK_GATES
+/* Sums up the counters of all workers. Invoked by the master */
+void get_gate_stats(const struct module *m, gate_t ogate,
+		struct gate_stats *stats);
+#endif
+
+/* Allocates and initializes per-worker private data of all modules
+ * for a newly launched worker. Returns 0 or -errno */
+int init_module_worker(int wid);
 
 #if SN_TRACE_MODULES
 void _trace_before_call(struct module *mod, struct module *next,
@@ -134,12 +195,33 @@ inline int disable_tcpdump(struct module *, int) {
 #endif
 
 
+static inline void __run_gate(struct output_gate *gate, 
+		struct pkt_batch *batch)
+{
+#if TCPDUMP_GATES
+	if (unlikely(gate->tcpdump))
+		dump_pcap_pkts(gate, batch);
+#endif
+
+	ctx.igate = gate->igate;
+	gate->f(gate->m, batch);
+}
+
+#if PROFILE_MODULES
+/* same as __run_gate(), but timed. see profile.c */
+void run_gate_profiled(struct module *m, gate_t ogate, 
+		struct pkt_batch *batch);
+#endif
+
 /* Pass packets to the next module.
  * Packet deallocation is callee's responsibility. */
 static inline void run_choose_module(struct module *m, gate_t ogate,
 				     struct pkt_batch *batch)
 {
 	struct output_gate *gate;
+#if TRACK_GATES
+	struct gate_stats *stats;
+#endif
 
 	if (unlikely(ogate >= m->allocated_gates)) {
 		deadend(NULL, batch);
@@ -148,21 +230,22 @@ static inline void run_choose_module(struct module *m, gate_t ogate,
 
 	gate = &m->gates[ogate];
 
-#if SN_TRACE_MODULES
-	_trace_before_call(m, next, batch);
-#endif
-
 #if TRACK_GATES
-	gate->cnt += 1;
-	gate->pkts += batch->cnt;
+	stats = &m->gate_stats[ctx.wid][ogate];
+	stats->cnt += 1;
+	stats->pkts += batch->cnt;
 #endif
 
-#if TCPDUMP_GATES
-	if (unlikely(gate->tcpdump))
-		dump_pcap_pkts(gate, batch);
+#if SN_TRACE_MODULES
+	_trace_before_call(m, gate->m, batch);
 #endif
 
-	gate->f(gate->m, batch);
+#if PROFILE_MODULES
+	if (unlikely(ctx.profiling))
+		run_gate_profiled(m, ogate, batch);
+	else
+#endif
+		__run_gate(gate, batch);
 
 #if SN_TRACE_MODULES
 	_trace_after_call();
@@ -186,38 +269,35 @@ static void run_split(struct module *m, const gate_t *ogates,
 {
 	int cnt = mixed_batch->cnt;
 	int num_pending = 0;
+	int last = 0;
 
 	snb_array_t p_pkt = &mixed_batch->pkts[0];
 
+	/* at most cnt distinct gates. on stack, since it may be reentrant */
 	gate_t pending[MAX_PKT_BURST];
 	struct pkt_batch batches[MAX_PKT_BURST];
 
-	struct pkt_batch *splits = ctx.splits;
-
-	/* phase 1: collect unique ogates into pending[] */
+	/* phase 1: collect unique ogates into pending[],
+	 * and packets into batches[] of the same index */
 	for (int i = 0; i < cnt; i++) {
-		struct pkt_batch *batch;
-		gate_t ogate;
-		
-		ogate = ogates[i];
-		batch = &splits[ogate];
-
-		batch_add(batch, *(p_pkt++));
+		gate_t ogate = ogates[i];
 
-		pending[num_pending] = ogate;
-		num_pending += (batch->cnt == 1);
-	}
+		/* consecutive packets are likely to share the gate */
+		if (unlikely(num_pending == 0 || pending[last] != ogate)) {
+			for (last = 0; last < num_pending; last++)
+				if (pending[last] == ogate)
+					break;
 
-	/* phase 2: move batches to local stack, since it may be reentrant */
-	for (int i = 0; i < num_pending; i++) {
-		struct pkt_batch *batch;
+			if (last == num_pending) {
+				pending[num_pending++] = ogate;
+				batch_clear(&batches[last]);
+			}
+		}
 
-		batch = &splits[pending[i]];
-		batch_copy(&batches[i], batch);
-		batch_clear(batch);
+		batch_add(&batches[last], *(p_pkt++));
 	}
 
-	/* phase 3: fire */
+	/* phase 2: fire */
 	for (int i = 0; i < num_pending; i++)
 		run_choose_module(m, pending[i], &batches[i]);
 }
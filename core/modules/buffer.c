@@ -1,24 +1,79 @@
 #include "../module.h"
+#include "../task.h"
+#include "../time.h"
 
-/* TODO: timer-triggered flush */
-/* TODO: use per-task stroage */
+/* Each worker accumulates packets in its own partial batch, so a Buffer can
+ * be fed by multiple workers. If timeout_us is given, buffered packets older
+ * than that are flushed by the tasks. A task flushes the batch of the worker
+ * it runs on, so every worker, including those added later, gets its own
+ * task in a default TC. Those TCs should not be migrated. */
 struct buffer_priv {
+	uint64_t timeout_tsc;		/* 0 if timer-triggered flush is off */
+};
+
+struct buffer_worker {
 	struct pkt_batch buf;
+	uint64_t first_tsc;		/* when the oldest packet was buffered */
 };
 
-static void buffer_deinit(struct module *m)
+static struct snobj *buffer_init(struct module *m, struct snobj *arg)
 {
 	struct buffer_priv *priv = get_priv(m);
-	struct pkt_batch *buf = &priv->buf;
 
-	if (buf->cnt)
-		snb_free_bulk(buf->pkts, buf->cnt);
+	int64_t timeout_us;
+
+	if (!arg)
+		return NULL;
+
+	timeout_us = snobj_eval_int(arg, "timeout_us");
+	if (timeout_us < 0)
+		return snobj_err(EINVAL, "'timeout_us' must be 0 or greater");
+
+	/* the tasks are created by buffer_init_worker() */
+	priv->timeout_tsc = timeout_us * tsc_hz / 1000000;
+
+	return NULL;
 }
 
-static void buffer_process_batch(struct module *m, struct pkt_batch *batch)
+/* Called for each active worker after buffer_init(), and for each worker
+ * launched later, while it is paused */
+static void buffer_init_worker(struct module *m, int wid)
 {
 	struct buffer_priv *priv = get_priv(m);
-	struct pkt_batch *buf = &priv->buf;
+
+	task_id_t tid;
+
+	if (!priv->timeout_tsc)
+		return;
+
+	tid = register_task(m, NULL);
+	if (tid == INVALID_TASK_ID) {
+		log_err("%s: task creation failed for worker %d\n",
+				m->name, wid);
+		return;
+	}
+
+	/* not left as an orphan, which may land on any worker */
+	assign_default_tc(wid, m->tasks[tid]);
+}
+
+static void buffer_deinit(struct module *m)
+{
+	struct buffer_worker *w;
+	int wid;
+
+	for_each_worker_priv(m, wid, w) {
+		struct pkt_batch *buf = &w->buf;
+
+		if (buf->cnt)
+			snb_free_bulk(buf->pkts, buf->cnt);
+	}
+}
+
+static void buffer_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct buffer_worker *w = get_worker_priv(m);
+	struct pkt_batch *buf = &w->buf;
 
 	int free_slots = MAX_PKT_BURST - buf->cnt;
 	int left = batch->cnt;
@@ -28,7 +83,7 @@ static void buffer_process_batch(struct module *m, struct pkt_batch *batch)
 
 	if (left >= free_slots) {
 		buf->cnt = MAX_PKT_BURST;
-		rte_memcpy((void *)p_buf, (void *)p_batch, 
+		rte_memcpy((void *)p_buf, (void *)p_batch,
 				free_slots * sizeof(struct snbuf *));
 
 		p_buf = &buf->pkts[0];
@@ -39,16 +94,60 @@ static void buffer_process_batch(struct module *m, struct pkt_batch *batch)
 		batch_clear(buf);
 	}
 
+	if (buf->cnt == 0 && left > 0)
+		w->first_tsc = ctx.current_tsc;
+
 	buf->cnt += left;
-	rte_memcpy((void *)p_buf, (void *)p_batch, 
+	rte_memcpy((void *)p_buf, (void *)p_batch,
 			left * sizeof(struct snbuf *));
 }
 
+static struct task_result buffer_run_task(struct module *m, void *arg)
+{
+	struct buffer_priv *priv = get_priv(m);
+	struct buffer_worker *w = get_worker_priv(m);
+	struct pkt_batch *buf = &w->buf;
+
+	struct pkt_batch batch;
+	struct task_result ret;
+
+	uint64_t total_bytes = 0;
+
+	const int pkt_overhead = 24;
+
+	int cnt = buf->cnt;
+
+	if (cnt == 0 || ctx.current_tsc - w->first_tsc < priv->timeout_tsc)
+	{
+		ret.packets = 0;
+		ret.bits = 0;
+		return ret;
+	}
+
+	/* the downstream may feed this module again, so move it out first */
+	batch_copy(&batch, buf);
+	batch_clear(buf);
+
+	for (int i = 0; i < cnt; i++)
+		total_bytes += snb_total_len(batch.pkts[i]);
+
+	run_next_module(m, &batch);
+
+	ret.packets = cnt;
+	ret.bits = (total_bytes + pkt_overhead * cnt) * 8;
+
+	return ret;
+}
+
 static const struct mclass buffer = {
 	.name		= "Buffer",
 	.priv_size 	= sizeof(struct buffer_priv),
+	.priv_worker_size = sizeof(struct buffer_worker),
+	.init		= buffer_init,
+	.init_worker	= buffer_init_worker,
 	.deinit		= buffer_deinit,
 	.process_batch  = buffer_process_batch,
+	.run_task	= buffer_run_task,
 };
 
 ADD_MCLASS(buffer)
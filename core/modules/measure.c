@@ -9,12 +9,18 @@
 #define min(a, b) (a < b ? a : b)
 #endif
 
-/* XXX: currently doesn't support multiple workers */
-struct measure_priv {
-	struct histogram hist;
+/* see timestamp.c */
+#define ATTR_R_TIMESTAMP	0
 
+struct measure_priv {
 	uint64_t start_time;
 	int warmup;		/* second */
+	int histogram;		/* keep a latency histogram per worker? */
+};
+
+/* updated only by each worker, summed up by measure_query() */
+struct measure_worker {
+	struct histogram hist;	/* 8MB of buckets. NULL if disabled */
 
 	uint64_t pkt_cnt;
 	uint64_t bytes_cnt;
@@ -24,39 +30,76 @@ struct measure_priv {
 static struct snobj *measure_init(struct module *m, struct snobj *arg)
 {
 	struct measure_priv *priv = get_priv(m);
+	int ret;
 
-	if (arg)
+	if (arg) {
 		priv->warmup = snobj_eval_int(arg, "warmup");
+		priv->histogram = snobj_eval_int(arg, "histogram");
+	}
 
-	init_hist(&priv->hist);
+	ret = add_metadata_attr(m, "timestamp", sizeof(uint64_t), MT_READ);
+	if (ret < 0)
+		return snobj_errno(-ret);
 
 	priv->start_time = get_time();
 
 	return NULL;
 }
 
-struct snobj *measure_query(struct module *m, struct snobj *q)
+static void measure_init_worker(struct module *m, int wid)
 {
 	struct measure_priv *priv = get_priv(m);
+	struct measure_worker *w = m->worker_priv[wid];
+
+	/* Off by default, not to take hugepages away from packet pools.
+	 * If this allocation fails, the histogram stays disabled */
+	if (priv->histogram)
+		w->hist.global_histogram = rte_zmalloc_socket("measure_hist",
+				HISTO_BUCKETS * sizeof(histo_count_t), 0,
+				workers[wid]->socket);
+}
+
+static void measure_deinit(struct module *m)
+{
+	struct measure_worker *w;
+	int wid;
+
+	for_each_worker_priv(m, wid, w)
+		rte_free(w->hist.global_histogram);
+}
 
-	struct snobj *r = snobj_map();
+struct snobj *measure_query(struct module *m, struct snobj *q)
+{
+	struct measure_worker *w;
+	int wid;
+
+	struct snobj *r;
 
-	uint64_t pkt_total = priv->pkt_cnt;
+	uint64_t pkt_total = 0;
+	uint64_t byte_total = 0;
+	uint64_t latency_total = 0;
 	const char* query = snobj_eval_str(q, "type");
 
 	if (!query)
 		return snobj_err(ENOTSUP, "Missing 'type' field");
 
+	for_each_worker_priv(m, wid, w) {
+		pkt_total += w->pkt_cnt;
+		byte_total += w->bytes_cnt;
+		latency_total += w->total_latency;
+	}
+
+	r = snobj_map();
+
 	snobj_map_set(r, "timestamp", snobj_double(get_epoch_time()));
 	snobj_map_set(r, "packets", snobj_int(pkt_total));
 
 	if (strcmp(query, "bw") == 0) {
-		uint64_t byte_total = priv->bytes_cnt;
 		uint64_t bits = (byte_total + pkt_total * 24) * 8;
 		snobj_map_set(r, "bits", snobj_int(bits));
 	} else if (strcmp(query, "latency") == 0) {
 		snobj_map_set(r, "total_latency_ns", 
-				snobj_int(priv->total_latency * 100ul));
+				snobj_int(latency_total * 100ul));
 	} else {
 		snobj_free(r);
 		return snobj_err(ENOTSUP, "Not supported query");
@@ -77,20 +120,38 @@ get_measure_packet(struct snbuf* pkt, uint64_t* time)
 	return available;
 }
 
+/* Returns 0 if the packet is not to be measured */
+static inline int get_timestamp(mt_offset_t offset, struct snbuf *pkt,
+		uint64_t *time)
+{
+	/* written by a Timestamp module on every path to here.
+	 * Otherwise the offset is invalid, since some packets may have
+	 * stale values (see compute_metadata_offsets()) */
+	if (is_valid_offset(offset)) {
+		*time = get_attr_with_offset(offset, pkt, uint64_t);
+		return *time != 0;
+	}
+
+	/* e.g., received from a wire */
+	return get_measure_packet(pkt, time);
+}
+
 static void
 measure_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	struct measure_priv *priv = get_priv(m);
+	struct measure_worker *w = get_worker_priv(m);
+	mt_offset_t offset = m->attr_offsets[ATTR_R_TIMESTAMP];
 
 	uint64_t time = get_time();
 	int i = 0;
 
 	if (time - priv->start_time >= priv->warmup) {
-		priv->pkt_cnt += batch->cnt;
+		w->pkt_cnt += batch->cnt;
 
 		for (i = 0; i < batch->cnt; i++) {
 			uint64_t pkt_time;
-			if (get_measure_packet(batch->pkts[i], &pkt_time)) {
+			if (get_timestamp(offset, batch->pkts[i], &pkt_time)) {
 				uint64_t diff;
 				
 				if (time >= pkt_time)
@@ -98,10 +159,11 @@ measure_process_batch(struct module *m, struct pkt_batch *batch)
 				else
 					continue;
 
-				priv->bytes_cnt += batch->pkts[i]->mbuf.pkt_len;
-				priv->total_latency += diff;
+				w->bytes_cnt += batch->pkts[i]->mbuf.pkt_len;
+				w->total_latency += diff;
 
-				record_latency(&priv->hist, diff);
+				if (w->hist.global_histogram)
+					record_latency(&w->hist, diff);
 			}
 		}
 	}
@@ -112,7 +174,10 @@ measure_process_batch(struct module *m, struct pkt_batch *batch)
 static const struct mclass measure = {
 	.name 		= "Measure",
 	.priv_size	= sizeof(struct measure_priv),
+	.priv_worker_size = sizeof(struct measure_worker),
 	.init 		= measure_init,
+	.init_worker	= measure_init_worker,
+	.deinit		= measure_deinit,
 	.process_batch 	= measure_process_batch,
 	.query		= measure_query,
 };
@@ -0,0 +1,275 @@
+#include "../module.h"
+#include "../time.h"
+
+#define MAX_MERGE_INPUTS	64
+#define DEFAULT_WEIGHT		8
+
+/* must be a power of 2, and at least 2 * MAX_PKT_BURST */
+#define INPUT_QUEUE_SIZE	(MAX_PKT_BURST * 2)
+#define INPUT_QUEUE_MASK	(INPUT_QUEUE_SIZE - 1)
+
+/* Packets from each input gate are queued separately, and only full batches
+ * are passed to the next module. Each batch is filled from the input queues
+ * in (deficit) weighted round robin: an input gets up to 'weight' packets
+ * per round. Partial batches are flushed by the task, if buffered longer than
+ * 'timeout_us' (if 0, whenever the task runs).
+ *
+ * XXX: currently doesn't support multiple workers.
+ * All upstream modules and the task should be on the same worker. */
+struct merge_input {
+	struct snbuf *pkts[INPUT_QUEUE_SIZE];
+	uint32_t head;		/* free-running indices */
+	uint32_t tail;
+
+	uint32_t weight;	/* packets per round */
+	uint32_t deficit;
+
+	uint64_t pkts_in;
+	uint64_t batches_in;
+	uint64_t pkts_out;
+} __cacheline_aligned;
+
+struct merge_priv {
+	uint32_t num_inputs;
+	uint32_t current;	/* the input being visited */
+	int visiting;		/* 1 if current input already got its weight */
+
+	uint32_t buffered;	/* total number of queued packets */
+	uint64_t first_tsc;	/* when the oldest packet was buffered */
+	uint64_t timeout_tsc;
+
+	uint64_t batches_out;
+	uint64_t dropped;	/* from unknown input gates */
+
+	struct merge_input inputs[MAX_MERGE_INPUTS];
+};
+
+static inline uint32_t input_len(const struct merge_input *in)
+{
+	return in->tail - in->head;
+}
+
+static struct snobj *merge_init(struct module *m, struct snobj *arg)
+{
+	struct merge_priv *priv = get_priv(m);
+
+	struct snobj *weights = NULL;
+	int64_t timeout_us = 0;
+	int num_inputs;
+
+	task_id_t tid;
+
+	if (!arg || snobj_type(arg) != TYPE_MAP)
+		return snobj_err(EINVAL, "Argument must be a map");
+
+	if (snobj_eval_exists(arg, "weights")) {
+		weights = snobj_eval(arg, "weights");
+		if (snobj_type(weights) != TYPE_LIST)
+			return snobj_err(EINVAL, "'weights' must be a list");
+		num_inputs = weights->size;
+	} else
+		num_inputs = snobj_eval_int(arg, "inputs");
+
+	if (num_inputs < 1 || num_inputs > MAX_MERGE_INPUTS)
+		return snobj_err(EINVAL, "Number of inputs must be 1-%d",
+				MAX_MERGE_INPUTS);
+
+	if (snobj_eval_exists(arg, "timeout_us"))
+		timeout_us = snobj_eval_int(arg, "timeout_us");
+
+	if (timeout_us < 0)
+		return snobj_err(EINVAL, "'timeout_us' must be 0 or greater");
+
+	for (int i = 0; i < num_inputs; i++) {
+		int64_t weight = DEFAULT_WEIGHT;
+
+		if (weights) {
+			struct snobj *w = snobj_list_get(weights, i);
+
+			if (snobj_type(w) != TYPE_INT)
+				return snobj_err(EINVAL,
+						"Weights must be integers");
+			weight = snobj_int_get(w);
+		}
+
+		if (weight < 1 || weight > MAX_PKT_BURST)
+			return snobj_err(EINVAL, "Weight must be 1-%d",
+					MAX_PKT_BURST);
+
+		priv->inputs[i].weight = weight;
+	}
+
+	priv->num_inputs = num_inputs;
+	priv->timeout_tsc = timeout_us * tsc_hz / 1000000;
+
+	tid = register_task(m, NULL);
+	if (tid == INVALID_TASK_ID)
+		return snobj_err(ENOMEM, "Task creation failed");
+
+	return NULL;
+}
+
+static void merge_deinit(struct module *m)
+{
+	struct merge_priv *priv = get_priv(m);
+
+	for (int i = 0; i < priv->num_inputs; i++) {
+		struct merge_input *in = &priv->inputs[i];
+
+		while (input_len(in))
+			snb_free(in->pkts[in->head++ & INPUT_QUEUE_MASK]);
+	}
+}
+
+/* Passes a batch of (up to MAX_PKT_BURST) queued packets to the next module.
+ * Returns the number of packets */
+static int merge_emit(struct module *m, struct merge_priv *priv)
+{
+	struct pkt_batch batch;
+
+	batch_clear(&batch);
+
+	while (batch.cnt < MAX_PKT_BURST && priv->buffered > 0) {
+		struct merge_input *in = &priv->inputs[priv->current];
+		uint32_t n;
+
+		if (!priv->visiting) {
+			in->deficit += in->weight;
+			priv->visiting = 1;
+		}
+
+		n = RTE_MIN(input_len(in), in->deficit);
+		n = RTE_MIN(n, (uint32_t)(MAX_PKT_BURST - batch.cnt));
+
+		for (int i = 0; i < n; i++)
+			batch.pkts[batch.cnt++] =
+				in->pkts[in->head++ & INPUT_QUEUE_MASK];
+
+		in->deficit -= n;
+		in->pkts_out += n;
+		priv->buffered -= n;
+
+		/* idle inputs do not accumulate credits */
+		if (input_len(in) == 0)
+			in->deficit = 0;
+
+		if (in->deficit == 0) {
+			priv->current = (priv->current + 1) % priv->num_inputs;
+			priv->visiting = 0;
+		}
+	}
+
+	if (priv->buffered > 0)
+		priv->first_tsc = ctx.current_tsc;
+
+	if (batch.cnt > 0) {
+		priv->batches_out++;
+		run_next_module(m, &batch);
+	}
+
+	return batch.cnt;
+}
+
+static void merge_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct merge_priv *priv = get_priv(m);
+	struct merge_input *in;
+
+	int cnt = batch->cnt;
+
+	if (unlikely(ctx.igate >= priv->num_inputs)) {
+		priv->dropped += cnt;
+		snb_free_bulk(batch->pkts, cnt);
+		return;
+	}
+
+	in = &priv->inputs[ctx.igate];
+
+	/* Fewer than MAX_PKT_BURST packets stay buffered between calls,
+	 * so this does not loop in practice */
+	while (INPUT_QUEUE_SIZE - input_len(in) < cnt)
+		merge_emit(m, priv);
+
+	if (priv->buffered == 0)
+		priv->first_tsc = ctx.current_tsc;
+
+	for (int i = 0; i < cnt; i++)
+		in->pkts[in->tail++ & INPUT_QUEUE_MASK] = batch->pkts[i];
+
+	in->pkts_in += cnt;
+	in->batches_in++;
+	priv->buffered += cnt;
+
+	while (priv->buffered >= MAX_PKT_BURST)
+		merge_emit(m, priv);
+}
+
+static struct task_result merge_run_task(struct module *m, void *arg)
+{
+	struct merge_priv *priv = get_priv(m);
+
+	struct task_result ret = {
+		.packets = 0,
+		.bits = 0,
+	};
+
+	if (priv->buffered == 0 ||
+			ctx.current_tsc - priv->first_tsc < priv->timeout_tsc)
+		return ret;
+
+	/* bits are not accounted, as the packets were already counted
+	 * by the upstream tasks */
+	ret.packets = merge_emit(m, priv);
+
+	return ret;
+}
+
+static struct snobj *merge_query(struct module *m, struct snobj *q)
+{
+	struct merge_priv *priv = get_priv(m);
+
+	struct snobj *r = snobj_map();
+	struct snobj *inputs = snobj_list();
+
+	for (int i = 0; i < priv->num_inputs; i++) {
+		struct merge_input *in = &priv->inputs[i];
+		struct snobj *input = snobj_map();
+
+		snobj_map_set(input, "igate", snobj_uint(i));
+		snobj_map_set(input, "weight", snobj_uint(in->weight));
+		snobj_map_set(input, "packets_in", snobj_uint(in->pkts_in));
+		snobj_map_set(input, "batches_in", snobj_uint(in->batches_in));
+		snobj_map_set(input, "packets_out", snobj_uint(in->pkts_out));
+		snobj_map_set(input, "buffered", snobj_uint(input_len(in)));
+
+		snobj_list_add(inputs, input);
+	}
+
+	snobj_map_set(r, "inputs", inputs);
+	snobj_map_set(r, "batches_out", snobj_uint(priv->batches_out));
+	snobj_map_set(r, "dropped", snobj_uint(priv->dropped));
+	snobj_map_set(r, "timestamp", snobj_double(get_epoch_time()));
+
+	return r;
+}
+
+static struct snobj *merge_get_desc(const struct module *m)
+{
+	const struct merge_priv *priv = get_priv_const(m);
+
+	return snobj_str_fmt("%u inputs, %u buffered",
+			priv->num_inputs, priv->buffered);
+}
+
+static const struct mclass merge = {
+	.name		= "Merge",
+	.priv_size 	= sizeof(struct merge_priv),
+	.init		= merge_init,
+	.deinit		= merge_deinit,
+	.query		= merge_query,
+	.get_desc	= merge_get_desc,
+	.process_batch  = merge_process_batch,
+	.run_task	= merge_run_task,
+};
+
+ADD_MCLASS(merge)
@@ -72,41 +72,61 @@ port_inc_run_task(struct module *m, void *arg)
 	struct pkt_batch batch;
 	struct task_result ret;
 
-	uint64_t received_bytes = 0;
+	uint64_t total_cnt = 0;
+	uint64_t total_bytes = 0;
+
+	/* may be larger than MAX_PKT_BURST (see tc_adapt_burst()) */
+	uint32_t burst = sched_current_burst(ctx.s);
 
-	const int pkt_burst = MAX_PKT_BURST;
 	const int pkt_overhead = 24;
 
+	int pkt_burst;
 	int cnt;
 
-	cnt = batch.cnt = priv->recv_pkts(p, qid, batch.pkts, pkt_burst);
+	do {
+		uint64_t received_bytes = 0;
+		int remote = 0;
+
+		pkt_burst = RTE_MIN(burst, MAX_PKT_BURST);
+		cnt = batch.cnt = priv->recv_pkts(p, qid, batch.pkts, 
+				pkt_burst);
+
+		if (cnt == 0)
+			break;
+
+		/* NOTE: we cannot skip this step since it might be used by 
+		 * scheduler */
+		if (priv->prefetch) {
+			for (int i = 0; i < cnt; i++) {
+				received_bytes += snb_total_len(batch.pkts[i]);
+				remote += snb_is_remote(batch.pkts[i]);
+				rte_prefetch0(snb_head_data(batch.pkts[i]));
+			}
+		} else {
+			for (int i = 0; i < cnt; i++) {
+				received_bytes += snb_total_len(batch.pkts[i]);
+				remote += snb_is_remote(batch.pkts[i]);
+			}
+		}
 
-	if (cnt == 0) {
-		ret.packets = 0;
-		ret.bits = 0;
-		return ret;
-	}
+		ctx.numa_stats.remote_pkts += remote;
+		ctx.numa_stats.local_pkts += cnt - remote;
 
-	/* NOTE: we cannot skip this step since it might be used by scheduler */
-	if (priv->prefetch) {
-		for (int i = 0; i < cnt; i++) {
-			received_bytes += snb_total_len(batch.pkts[i]);
-			rte_prefetch0(snb_head_data(batch.pkts[i]));
+		if (!(p->driver->flags & DRIVER_FLAG_SELF_INC_STATS)) {
+			p->queue_stats[PACKET_DIR_INC][qid].packets += cnt;
+			p->queue_stats[PACKET_DIR_INC][qid].bytes += 
+				received_bytes;
 		}
-	} else {
-		for (int i = 0; i < cnt; i++)
-			received_bytes += snb_total_len(batch.pkts[i]);
-	}
 
-	ret.packets = cnt;
-	ret.bits = (received_bytes + pkt_overhead * cnt) * 8;
+		run_next_module(m, &batch);
 
-	if (!(p->driver->flags & DRIVER_FLAG_SELF_INC_STATS)) {
-		p->queue_stats[PACKET_DIR_INC][qid].packets += cnt;
-		p->queue_stats[PACKET_DIR_INC][qid].bytes += received_bytes;
-	}
+		total_cnt += cnt;
+		total_bytes += received_bytes;
+		burst -= cnt;
+	} while (burst > 0 && cnt == pkt_burst);	/* more in the queue? */
 
-	run_next_module(m, &batch);
+	ret.packets = total_cnt;
+	ret.bits = (total_bytes + pkt_overhead * total_cnt) * 8;
 
 	return ret;
 }
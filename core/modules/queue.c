@@ -0,0 +1,183 @@
+#include <rte_malloc.h>
+
+#include "../module.h"
+#include "../time.h"
+#include "../tc.h"
+
+#define DEFAULT_QUEUE_SIZE	1024
+#define DEFAULT_BACKOFF_US	10
+
+/* Packets are enqueued by process_batch() (on any worker) and dequeued by
+ * the task (on the worker it is attached to), for pipelining across cores.
+ * The task is the only consumer, so dequeue is always single-consumer. */
+struct queue_priv {
+	struct llring *queue;
+	int multi_producer;
+	int prefetch;
+
+	/* how long the producer TC backs off when the watermark is exceeded */
+	uint64_t backoff_tsc;
+};
+
+static struct snobj *queue_init(struct module *m, struct snobj *arg)
+{
+	struct queue_priv *priv = get_priv(m);
+
+	task_id_t tid;
+
+	uint32_t size = DEFAULT_QUEUE_SIZE;
+	uint32_t high_water = 0;
+	uint64_t backoff_us = DEFAULT_BACKOFF_US;
+
+	int ret;
+
+	if (arg) {
+		if (snobj_type(arg) != TYPE_MAP)
+			return snobj_err(EINVAL, "Argument must be a map");
+
+		if (snobj_eval_exists(arg, "size"))
+			size = snobj_eval_uint(arg, "size");
+
+		if (snobj_eval_exists(arg, "high_water"))
+			high_water = snobj_eval_uint(arg, "high_water");
+
+		if (snobj_eval_exists(arg, "backoff_us"))
+			backoff_us = snobj_eval_uint(arg, "backoff_us");
+
+		priv->multi_producer = !!snobj_eval_int(arg, "multi_producer");
+		priv->prefetch = !!snobj_eval_int(arg, "prefetch");
+	}
+
+	if (size < 4 || size > (1 << 24) || (size & (size - 1)))
+		return snobj_err(EINVAL, "'size' must be a power of 2 "
+				"between 4 and %d", 1 << 24);
+
+	if (high_water >= size)
+		return snobj_err(EINVAL, "'high_water' must be less than "
+				"'size' (%u)", size);
+
+	priv->backoff_tsc = backoff_us * tsc_hz / 1000000;
+
+	tid = register_task(m, NULL);
+	if (tid == INVALID_TASK_ID)
+		return snobj_err(ENOMEM, "Task creation failed");
+
+	priv->queue = rte_zmalloc("queue", llring_bytes_with_slots(size), 0);
+	if (!priv->queue)
+		return snobj_errno(ENOMEM);
+
+	ret = llring_init(priv->queue, size, !priv->multi_producer, 1);
+	if (ret) {
+		rte_free(priv->queue);
+		return snobj_err(EINVAL, "llring_init() failed");
+	}
+
+	/* 0 disables the watermark */
+	llring_set_water_mark(priv->queue, high_water);
+
+	return NULL;
+}
+
+static void queue_deinit(struct module *m)
+{
+	struct queue_priv *priv = get_priv(m);
+
+	struct snbuf *pkts[MAX_PKT_BURST];
+	int cnt;
+
+	if (!priv->queue)
+		return;
+
+	while ((cnt = llring_sc_dequeue_burst(priv->queue, (void **)pkts,
+					MAX_PKT_BURST)) > 0)
+		snb_free_bulk(pkts, cnt);
+
+	rte_free(priv->queue);
+}
+
+static struct snobj *queue_get_desc(const struct module *m)
+{
+	const struct queue_priv *priv = get_priv_const(m);
+	const struct llring *ring = priv->queue;
+
+	return snobj_str_fmt("%u/%u", llring_count(ring), ring->common.slots);
+}
+
+static void queue_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct queue_priv *priv = get_priv(m);
+
+	int queued;
+	int ret;
+
+	if (priv->multi_producer)
+		ret = llring_mp_enqueue_burst(priv->queue,
+				(void **)batch->pkts, batch->cnt);
+	else
+		ret = llring_sp_enqueue_burst(priv->queue,
+				(void **)batch->pkts, batch->cnt);
+
+	queued = ret & RING_SZ_MASK;
+
+	/* tell the producer TC to slow down. Once the ring is full, bursts
+	 * are cut short without RING_QUOT_EXCEED */
+	if (unlikely((ret & RING_QUOT_EXCEED) || queued < batch->cnt))
+		sched_backpressure(ctx.s, priv->backoff_tsc);
+
+	if (unlikely(queued < batch->cnt))
+		snb_free_bulk(batch->pkts + queued, batch->cnt - queued);
+}
+
+static struct task_result queue_run_task(struct module *m, void *arg)
+{
+	struct queue_priv *priv = get_priv(m);
+
+	struct pkt_batch batch;
+	struct task_result ret;
+
+	uint64_t total_bytes = 0;
+
+	const int pkt_overhead = 24;
+
+	int cnt;
+
+	cnt = llring_sc_dequeue_burst(priv->queue, (void **)batch.pkts,
+			MAX_PKT_BURST);
+
+	if (cnt == 0) {
+		ret.packets = 0;
+		ret.bits = 0;
+		return ret;
+	}
+
+	batch.cnt = cnt;
+
+	if (priv->prefetch) {
+		for (int i = 0; i < cnt; i++) {
+			total_bytes += snb_total_len(batch.pkts[i]);
+			rte_prefetch0(snb_head_data(batch.pkts[i]));
+		}
+	} else {
+		for (int i = 0; i < cnt; i++)
+			total_bytes += snb_total_len(batch.pkts[i]);
+	}
+
+	run_next_module(m, &batch);
+
+	ret.packets = cnt;
+	ret.bits = (total_bytes + pkt_overhead * cnt) * 8;
+
+	return ret;
+}
+
+static const struct mclass queue = {
+	.name 		= "Queue",
+	.priv_size	= sizeof(struct queue_priv),
+	.init 		= queue_init,
+	.deinit		= queue_deinit,
+	.get_desc	= queue_get_desc,
+	.process_batch 	= queue_process_batch,
+	.run_task 	= queue_run_task,
+};
+
+ADD_MCLASS(queue)
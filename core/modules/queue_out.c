@@ -68,6 +68,8 @@ static void queue_out_process_batch(struct module *m,
 	uint64_t sent_bytes = 0;
 	int sent_pkts;
 
+	port_drop_chained(p, qid, batch);
+
 	sent_pkts = priv->send_pkts(p, qid, batch->pkts, batch->cnt);
 
 	if (!(p->driver->flags & DRIVER_FLAG_SELF_OUT_STATS)) {
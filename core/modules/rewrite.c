@@ -98,6 +98,7 @@ static void rewrite_process_batch(struct module *m, struct pkt_batch *batch)
 			char *ptr = snb_head_data(snb);
 			uint16_t size = priv->template_size[start + i];
 
+			snb_free_tail(snb);
 			snb->mbuf.pkt_len = snb->mbuf.data_len = size;
 			rte_memcpy(ptr, priv->templates[start + i], size);
 		}
@@ -1,13 +1,16 @@
 #include "../module.h"
 
-/* XXX: currently doesn't support multiple workers */
 struct roundrobin_priv {
 	gate_t gates[MAX_OUTPUT_GATES];
 	uint32_t ngates;
-	uint32_t current_gate;
 	uint8_t batch_mode;
 };
 
+/* each worker rotates on its own */
+struct roundrobin_worker {
+	uint32_t current_gate;
+};
+
 static struct snobj *roundrobin_init(struct module *m, struct snobj *arg)
 {	
 	struct roundrobin_priv* priv = get_priv(m);
@@ -16,8 +19,6 @@ static struct snobj *roundrobin_init(struct module *m, struct snobj *arg)
 
 	priv->batch_mode = (snobj_eval_int(arg, "packet_mode") == 0);
 
-	priv->current_gate = 0;
-
 	if (snobj_eval_exists(arg, "gates") &&
 	      snobj_eval(arg, "gates")->type == TYPE_INT) {
 		int gate = snobj_eval_int(arg, "gates");
@@ -89,15 +90,16 @@ static void
 roundrobin_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	struct roundrobin_priv* priv = get_priv(m);
+	struct roundrobin_worker *w = get_worker_priv(m);
 	gate_t ogates[MAX_PKT_BURST];
 	if (priv->batch_mode) {
-		gate_t gate = priv->gates[priv->current_gate];
-		priv->current_gate = (priv->current_gate + 1) % priv->ngates;
+		gate_t gate = priv->gates[w->current_gate];
+		w->current_gate = (w->current_gate + 1) % priv->ngates;
 		run_choose_module(m, gate, batch);
 	} else {
 		for (int i = 0; i < batch->cnt; i++) {
-			ogates[i] = priv->gates[priv->current_gate];
-			priv->current_gate = (priv->current_gate + 1) % 
+			ogates[i] = priv->gates[w->current_gate];
+			w->current_gate = (w->current_gate + 1) % 
 						priv->ngates;
 		}
 		run_split(m, ogates, batch);
@@ -107,6 +109,7 @@ roundrobin_process_batch(struct module *m, struct pkt_batch *batch)
 static const struct mclass roundrobin = {
 	.name 		= "Roundrobin",
 	.priv_size	= sizeof(struct roundrobin_priv),
+	.priv_worker_size = sizeof(struct roundrobin_worker),
 	.init 		= roundrobin_init,
 	.process_batch 	= roundrobin_process_batch,
 	.query		= roundrobin_query,
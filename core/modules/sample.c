@@ -0,0 +1,343 @@
+#include <pthread.h>
+
+#include <sys/uio.h>
+
+#include <rte_malloc.h>
+
+#include "../module.h"
+#include "../time.h"
+
+#define DEFAULT_RING_SIZE	1024
+
+/* All packets are passed to the next module as they are, and copies of
+ * sampled ones (1 in 'one_in', up to 'max_pps' per worker) are put into
+ * a ring. A non-worker thread drains the ring into 'file', in pcap format.
+ * 'file' can be a regular file or a FIFO (e.g., for tcpdump/wireshark). */
+struct sample_worker {
+	uint32_t countdown;
+	uint64_t next_tsc;	/* for max_pps */
+
+	uint64_t sampled;
+	uint64_t dropped;	/* ring full or out of buffers */
+};
+
+struct sample_priv {
+	struct llring *ring;
+
+	uint32_t one_in;
+	uint64_t interval_tsc;		/* 0 if not rate limited */
+
+	/* for tsc -> wall clock time conversion */
+	uint64_t base_tsc;
+	uint64_t base_us;
+
+	int fd;
+	pthread_t drainer;
+	volatile int quit;
+
+	uint64_t written;		/* by the drainer thread */
+	uint64_t write_errors;
+};
+
+/* The timestamp of sampled packets is stored in the scratchpad */
+static inline uint64_t *sample_ts(struct snbuf *snb)
+{
+	return (uint64_t *)snb->_scratchpad;
+}
+
+/* Only the first segment of chained (jumbo) packets is captured.
+ * The original length is stored next to the timestamp */
+static inline uint32_t *sample_orig_len(struct snbuf *snb)
+{
+	return (uint32_t *)(snb->_scratchpad + sizeof(uint64_t));
+}
+
+static void write_pkt(struct sample_priv *priv, struct snbuf *pkt)
+{
+	struct pcap_rec_hdr rec;
+	struct iovec iov[2];
+	uint64_t ts_us = *sample_ts(pkt);
+	int len = snb_head_len(pkt);
+	int ret;
+
+	rec.ts_sec = ts_us / 1000000;
+	rec.ts_usec = ts_us % 1000000;
+	rec.incl_len = len;
+	rec.orig_len = *sample_orig_len(pkt);
+
+	iov[0] = (struct iovec){.iov_base = &rec, .iov_len = sizeof(rec)};
+	iov[1] = (struct iovec){.iov_base = snb_head_data(pkt), .iov_len = len};
+
+	/* for FIFOs, each write is atomic (< PIPE_BUF) */
+	ret = writev(priv->fd, iov, 2);
+	if (ret < 0) {
+		priv->write_errors++;
+
+		/* the reader is gone */
+		if (errno == EPIPE)
+			priv->quit = 1;
+	} else
+		priv->written++;
+}
+
+static void *drain_ring(void *arg)
+{
+	struct sample_priv *priv = arg;
+
+	struct snbuf *pkts[MAX_PKT_BURST];
+	int cnt;
+
+	while (!priv->quit) {
+		cnt = llring_sc_dequeue_burst(priv->ring, (void **)pkts,
+				MAX_PKT_BURST);
+
+		if (cnt == 0) {
+			usleep(1000);
+			continue;
+		}
+
+		for (int i = 0; i < cnt; i++) {
+			if (!priv->quit)
+				write_pkt(priv, pkts[i]);
+			snb_free(pkts[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static struct snobj *sample_init(struct module *m, struct snobj *arg)
+{
+	static const struct pcap_hdr PCAP_FILE_HDR = {
+		.magic_number = PCAP_MAGIC_NUMBER,
+		.version_major = PCAP_VERSION_MAJOR,
+		.version_minor = PCAP_VERSION_MINOR,
+		.thiszone = PCAP_THISZONE,
+		.sigfigs = PCAP_SIGFIGS,
+		.snaplen = PCAP_SNAPLEN,
+		.network = PCAP_NETWORK,
+	};
+
+	struct sample_priv *priv = get_priv(m);
+
+	const char *file;
+	int64_t one_in = 1;
+	int64_t max_pps = 0;
+	int64_t ring_size = DEFAULT_RING_SIZE;
+
+	int ret;
+
+	priv->fd = -1;
+
+	if (!arg || snobj_type(arg) != TYPE_MAP)
+		return snobj_err(EINVAL, "Argument must be a map");
+
+	file = snobj_eval_str(arg, "file");
+	if (!file)
+		return snobj_err(EINVAL, "'file' must be given as a string");
+
+	if (snobj_eval_exists(arg, "one_in"))
+		one_in = snobj_eval_int(arg, "one_in");
+
+	if (snobj_eval_exists(arg, "max_pps"))
+		max_pps = snobj_eval_int(arg, "max_pps");
+
+	if (snobj_eval_exists(arg, "ring_size"))
+		ring_size = snobj_eval_int(arg, "ring_size");
+
+	if (one_in < 1 || one_in > UINT32_MAX)
+		return snobj_err(EINVAL, "'one_in' must be a positive integer");
+
+	if (max_pps < 0)
+		return snobj_err(EINVAL, "'max_pps' must be 0 or greater");
+
+	if (ring_size < 4 || ring_size > (1 << 20) ||
+			(ring_size & (ring_size - 1)))
+		return snobj_err(EINVAL, "'ring_size' must be a power of 2 "
+				"between 4 and %d", 1 << 20);
+
+	priv->one_in = one_in;
+	priv->interval_tsc = max_pps ? tsc_hz / max_pps : 0;
+
+	priv->base_tsc = rdtsc();
+	priv->base_us = get_epoch_time() * 1000000;
+
+	/* O_NONBLOCK: writes do not stall on a FIFO whose reader is slow.
+	 * Opening a FIFO without a reader fails with ENXIO, instead of
+	 * blocking until one shows up */
+	priv->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+	if (priv->fd < 0) {
+		if (errno == ENXIO)
+			return snobj_err(ENXIO, "FIFO '%s' has no reader. "
+					"Start the reader (e.g., tcpdump) "
+					"first", file);
+		return snobj_err(errno, "Cannot open '%s'", file);
+	}
+
+	ret = write(priv->fd, &PCAP_FILE_HDR, sizeof(PCAP_FILE_HDR));
+	if (ret < 0) {
+		ret = errno;
+		close(priv->fd);
+		return snobj_err(ret, "Cannot write to '%s'", file);
+	}
+
+	priv->ring = rte_zmalloc("sample", llring_bytes_with_slots(ring_size),
+			0);
+	if (!priv->ring) {
+		close(priv->fd);
+		return snobj_errno(ENOMEM);
+	}
+
+	/* multi-producer (workers), single-consumer (the drainer) */
+	llring_init(priv->ring, ring_size, 0, 1);
+
+	ret = pthread_create(&priv->drainer, NULL, drain_ring, priv);
+	if (ret) {
+		rte_free(priv->ring);
+		close(priv->fd);
+		return snobj_err(ret, "pthread_create() failed");
+	}
+
+	return NULL;
+}
+
+static void sample_init_worker(struct module *m, int wid)
+{
+	struct sample_priv *priv = get_priv(m);
+	struct sample_worker *w = m->worker_priv[wid];
+
+	w->countdown = priv->one_in;
+}
+
+static void sample_deinit(struct module *m)
+{
+	struct sample_priv *priv = get_priv(m);
+
+	struct snbuf *pkts[MAX_PKT_BURST];
+	int cnt;
+
+	priv->quit = 1;
+	pthread_join(priv->drainer, NULL);
+
+	while ((cnt = llring_sc_dequeue_burst(priv->ring, (void **)pkts,
+					MAX_PKT_BURST)) > 0)
+		snb_free_bulk(pkts, cnt);
+
+	rte_free(priv->ring);
+	close(priv->fd);
+}
+
+static struct snobj *sample_query(struct module *m, struct snobj *q)
+{
+	struct sample_priv *priv = get_priv(m);
+	struct sample_worker *w;
+	int wid;
+
+	struct snobj *r = snobj_map();
+
+	uint64_t sampled = 0;
+	uint64_t dropped = 0;
+
+	for_each_worker_priv(m, wid, w) {
+		sampled += w->sampled;
+		dropped += w->dropped;
+	}
+
+	snobj_map_set(r, "sampled", snobj_uint(sampled));
+	snobj_map_set(r, "dropped", snobj_uint(dropped));
+	snobj_map_set(r, "written", snobj_uint(priv->written));
+	snobj_map_set(r, "write_errors", snobj_uint(priv->write_errors));
+	snobj_map_set(r, "timestamp", snobj_double(get_epoch_time()));
+
+	return r;
+}
+
+static struct snobj *sample_get_desc(const struct module *m)
+{
+	const struct sample_priv *priv = get_priv_const(m);
+
+	if (priv->interval_tsc)
+		return snobj_str_fmt("1/%u, %lu pps", priv->one_in,
+				tsc_hz / priv->interval_tsc);
+	else
+		return snobj_str_fmt("1/%u", priv->one_in);
+}
+
+static struct snbuf *sample_copy(struct sample_priv *priv, struct snbuf *src)
+{
+	struct snbuf *dst;
+	int len = snb_head_len(src);
+
+	dst = __snb_alloc_pool(ctx.pframe_pool);
+	if (!dst)
+		return NULL;
+
+	rte_memcpy(snb_append(dst, len), snb_head_data(src), len);
+
+	*sample_orig_len(dst) = snb_total_len(src);
+	*sample_ts(dst) = priv->base_us +
+		(ctx.current_tsc - priv->base_tsc) * 1000000 / tsc_hz;
+
+	return dst;
+}
+
+static void sample_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct sample_priv *priv = get_priv(m);
+	struct sample_worker *w = get_worker_priv(m);
+
+	uint32_t countdown = w->countdown;
+	int cnt = batch->cnt;
+
+	/* fast path: no packet in this batch is sampled */
+	if (likely(countdown > cnt)) {
+		w->countdown = countdown - cnt;
+		goto done;
+	}
+
+	for (int i = 0; i < cnt; i++) {
+		struct snbuf *copy;
+
+		if (--countdown)
+			continue;
+
+		countdown = priv->one_in;
+
+		if (priv->interval_tsc) {
+			if (ctx.current_tsc < w->next_tsc)
+				continue;
+			w->next_tsc = ctx.current_tsc + priv->interval_tsc;
+		}
+
+		copy = sample_copy(priv, batch->pkts[i]);
+		if (!copy || llring_mp_enqueue(priv->ring, copy) ==
+				-LLRING_ERR_NOBUF)
+		{
+			if (copy)
+				snb_free(copy);
+			w->dropped++;
+			continue;
+		}
+
+		w->sampled++;
+	}
+
+	w->countdown = countdown;
+
+done:
+	run_next_module(m, batch);
+}
+
+static const struct mclass sample = {
+	.name 		= "Sample",
+	.priv_size	= sizeof(struct sample_priv),
+	.priv_worker_size = sizeof(struct sample_worker),
+	.init 		= sample_init,
+	.init_worker	= sample_init_worker,
+	.deinit		= sample_deinit,
+	.query		= sample_query,
+	.get_desc	= sample_get_desc,
+	.process_batch 	= sample_process_batch,
+};
+
+ADD_MCLASS(sample)
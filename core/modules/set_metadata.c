@@ -0,0 +1,90 @@
+#include "../module.h"
+
+/* Sets metadata attributes of packets to constant values.
+ * e.g., SetMetadata(attrs=[{'name': 'color', 'size': 1, 'value': 3}]) */
+struct setmd_priv {
+	int num_attrs;
+	uint64_t values[MAX_ATTRS_PER_MODULE];
+};
+
+static struct snobj *add_attr_one(struct module *m, struct snobj *attr)
+{
+	struct setmd_priv *priv = get_priv(m);
+
+	const char *name;
+	int size;
+	int ret;
+
+	if (snobj_type(attr) != TYPE_MAP)
+		return snobj_err(EINVAL, "'attrs' must be a list of maps");
+
+	name = snobj_eval_str(attr, "name");
+	if (!name)
+		return snobj_err(EINVAL, "Missing 'name' field");
+
+	size = snobj_eval_int(attr, "size");
+	if (size != 1 && size != 2 && size != 4 && size != 8)
+		return snobj_err(EINVAL, "'size' must be 1, 2, 4, or 8");
+
+	ret = add_metadata_attr(m, name, size, MT_WRITE);
+	if (ret < 0)
+		return snobj_err(-ret, "Cannot add attribute '%s'", name);
+
+	/* little endian: the lower 'size' bytes are written */
+	priv->values[ret] = snobj_eval_uint(attr, "value");
+	priv->num_attrs = ret + 1;
+
+	return NULL;
+}
+
+static struct snobj *setmd_init(struct module *m, struct snobj *arg)
+{
+	struct snobj *attrs = snobj_eval(arg, "attrs");
+
+	if (!attrs || snobj_type(attrs) != TYPE_LIST)
+		return snobj_err(EINVAL, "'attrs' must be a list of maps");
+
+	for (int i = 0; i < attrs->size; i++) {
+		struct snobj *err;
+
+		err = add_attr_one(m, snobj_list_get(attrs, i));
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+static void setmd_process_batch(struct module *m, struct pkt_batch *batch)
+{
+	struct setmd_priv *priv = get_priv(m);
+
+	for (int i = 0; i < priv->num_attrs; i++) {
+		mt_offset_t offset = m->attr_offsets[i];
+		const void *value = &priv->values[i];
+		int size = m->attrs[i].size;
+
+		/* nobody downstream reads it? */
+		if (!is_valid_offset(offset))
+			continue;
+
+		for (int j = 0; j < batch->cnt; j++) {
+			struct snbuf *pkt = batch->pkts[j];
+
+			rte_memcpy(_ptr_attr_with_offset(offset, pkt),
+					value, size);
+		}
+	}
+
+	run_next_module(m, batch);
+}
+
+static const struct mclass setmd = {
+	.name 		= "SetMetadata",
+	.def_module_name = "setmd",
+	.priv_size	= sizeof(struct setmd_priv),
+	.init 		= setmd_init,
+	.process_batch 	= setmd_process_batch,
+};
+
+ADD_MCLASS(setmd)
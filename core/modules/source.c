@@ -34,7 +34,8 @@ static struct snobj *handle_pkt_size(struct source_priv *priv,
 
 	val = snobj_uint_get(pkt_size);
 
-	if (val == 0 || val > SNBUF_DATA)
+	/* packets larger than SNBUF_DATA are chained */
+	if (val == 0 || val > ETHER_MAX_JUMBO_FRAME_LEN)
 		return snobj_err(EINVAL, "Invalid packet size");
 
 	priv->pkt_size = val;
@@ -68,10 +69,21 @@ source_run_task(struct module *m, void *arg)
 
 	const int pkt_overhead = 24;
 
-	uint64_t total_bytes = priv->pkt_size * MAX_PKT_BURST;
+	const int pkt_size = priv->pkt_size;
+	const int head_size = RTE_MIN(pkt_size, SNBUF_DATA);
 
-	const int cnt = snb_alloc_bulk(batch.pkts, MAX_PKT_BURST, 
-			priv->pkt_size);
+	uint64_t total_bytes = pkt_size * MAX_PKT_BURST;
+
+	int cnt = snb_alloc_bulk(batch.pkts, MAX_PKT_BURST, head_size);
+
+	if (unlikely(pkt_size > head_size)) {
+		for (int i = 0; i < cnt; i++) {
+			if (snb_extend(batch.pkts[i], pkt_size - head_size)) {
+				snb_free_bulk(batch.pkts, cnt);
+				cnt = 0;
+			}
+		}
+	}
 
 	if (cnt > 0) {
 		batch.cnt = cnt;
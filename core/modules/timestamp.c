@@ -3,6 +3,11 @@
 #include "../module.h"
 #include "../utils/histogram.h"
 
+/* The timestamp is written to the packet payload (for Measure across a wire)
+ * and to the "timestamp" metadata attribute (for Measure in the same
+ * pipeline, so it does not need to parse the packet). 0 during warmup */
+#define ATTR_W_TIMESTAMP	0
+
 /* XXX: currently doesn't support multiple workers */
 struct timestamp_priv {
 	uint64_t start_time;
@@ -14,10 +19,15 @@ struct timestamp_priv {
 static struct snobj *timestamp_init(struct module *m, struct snobj *arg)
 {
 	struct timestamp_priv *priv = get_priv(m);
+	int ret;
 
 	if (arg)
 		priv->warmup = snobj_eval_int(arg, "warmup");
 
+	ret = add_metadata_attr(m, "timestamp", sizeof(uint64_t), MT_WRITE);
+	if (ret < 0)
+		return snobj_errno(-ret);
+
 	return NULL;
 }
 
@@ -54,6 +64,7 @@ static void
 timestamp_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	struct timestamp_priv *priv = get_priv(m);
+	mt_offset_t offset = m->attr_offsets[ATTR_W_TIMESTAMP];
 
 	int account_for_packet = 0;
 	uint64_t time = get_time();
@@ -75,6 +86,15 @@ timestamp_process_batch(struct module *m, struct pkt_batch *batch)
 	for (i = 0; i < batch->cnt; i++)
 		timestamp_packet(batch->pkts[i], time, account_for_packet);
 
+	/* nobody downstream reads it? */
+	if (is_valid_offset(offset)) {
+		uint64_t value = account_for_packet ? time : 0;
+
+		for (i = 0; i < batch->cnt; i++)
+			set_attr_with_offset(offset, batch->pkts[i], 
+					uint64_t, value);
+	}
+
 	run_next_module(m, batch);
 }
 
@@ -1,30 +1,72 @@
 #include <string.h>
 
 #include "../module.h"
+#include "../utils/vlan.h"
+
+static inline void vpop_one(struct snbuf *pkt)
+{
+	char *old_head = snb_head_data(pkt);
+	__m128i ethh;
+	uint16_t tpid;
+	int tagged;
+
+	ethh = _mm_loadu_si128((__m128i *)old_head);
+	tpid = _mm_extract_epi16(ethh, 6);
+
+	tagged = (tpid == rte_cpu_to_be_16(0x8100)) ||
+			(tpid == rte_cpu_to_be_16(0x88a8));
+
+	if (tagged && snb_adj(pkt, 4)) {
+		ethh = _mm_slli_si128(ethh, 4);
+		_mm_storeu_si128((__m128i *)old_head, ethh);
+	}
+}
+
+#if __AVX2__
+/* branch-free version of vpop_one(). tagged must be 0 or 1 */
+static inline void vpop_strip(struct snbuf *pkt, char *head, int tagged)
+{
+	vlan_strip_hdr(head, tagged);
+
+	pkt->mbuf.data_off += tagged << 2;
+	pkt->mbuf.data_len -= tagged << 2;
+	pkt->mbuf.pkt_len -= tagged << 2;
+}
+#endif
 
 static void vpop_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	int cnt = batch->cnt;
+	int i = 0;
 
-	for (int i = 0; i < cnt; i++) {
-		struct snbuf *pkt = batch->pkts[i];
-		char *old_head = snb_head_data(pkt);
-		__m128i ethh;
-		uint16_t tpid;
+#if __AVX2__
+	for (; i + 4 <= cnt; i += 4) {
+		snb_array_t pkts = &batch->pkts[i];
+		char *heads[4];
+		int len_ok = 1;
 		int tagged;
-	
-		ethh = _mm_loadu_si128((__m128i *)old_head);
-		tpid = _mm_extract_epi16(ethh, 6);
 
-		tagged = (tpid == rte_cpu_to_be_16(0x8100)) ||
-				(tpid == rte_cpu_to_be_16(0x88a8));
+		for (int j = 0; j < 4; j++) {
+			heads[j] = snb_head_data(pkts[j]);
+			len_ok &= (snb_head_len(pkts[j]) >= 4);
+		}
 
-		if (tagged && snb_adj(pkt, 4)) {
-			ethh = _mm_slli_si128(ethh, 4);
-			_mm_storeu_si128((__m128i *)old_head, ethh);
+		if (unlikely(!len_ok)) {
+			for (int j = 0; j < 4; j++)
+				vpop_one(pkts[j]);
+			continue;
 		}
+
+		tagged = vlan_tagged_mask_x4(vlan_gather_x4(heads));
+
+		for (int j = 0; j < 4; j++)
+			vpop_strip(pkts[j], heads[j], (tagged >> j) & 1);
 	}
-		
+#endif
+
+	for (; i < cnt; i++)
+		vpop_one(batch->pkts[i]);
+
 	run_next_module(m, batch);
 }
 
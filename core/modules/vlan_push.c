@@ -4,6 +4,7 @@
 
 #include "../module.h"
 #include "../utils/simd.h"
+#include "../utils/vlan.h"
 
 struct vlan_push_priv {
 	/* network order */
@@ -45,36 +46,77 @@ static struct snobj *vpush_get_desc(const struct module *m)
 			vlan_tag_cpu & 0x0fff);
 }
 
+static inline void vpush_one(struct snbuf *pkt, 
+		uint32_t vlan_tag, uint32_t qinq_tag)
+{
+	char *new_head;
+	__m128i ethh;
+	uint16_t tpid;
+
+	if ((new_head = snb_prepend(pkt, 4)) != NULL) {
+		/* shift 12 bytes to the left by 4 bytes */
+		ethh = _mm_loadu_si128((__m128i *)(new_head + 4));
+		tpid = _mm_extract_epi16(ethh, 6);
+
+		ethh = _mm_insert_epi32(ethh, 
+				(tpid == rte_cpu_to_be_16(0x8100)) ?
+					qinq_tag : vlan_tag,
+				3);
+
+		_mm_storeu_si128((__m128i *)new_head, ethh);
+	}
+}
+
 /* the behavior is undefined if a packet is already double tagged */
 static void vpush_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	struct vlan_push_priv *priv = get_priv(m);
 	int cnt = batch->cnt;
+	int i = 0;
 
 	uint32_t vlan_tag = priv->vlan_tag;
 	uint32_t qinq_tag = priv->qinq_tag;
 
-	//uint32_t tag[2] = {vlan_tag, qinq_tag};
+#if __AVX2__
+	for (; i + 4 <= cnt; i += 4) {
+		snb_array_t pkts = &batch->pkts[i];
+		char *heads[4];
+		int headroom_ok = 1;
+		int ctagged;
+
+		for (int j = 0; j < 4; j++) {
+			heads[j] = snb_head_data(pkts[j]);
+			headroom_ok &= (pkts[j]->mbuf.data_off >= 4);
+		}
+
+		if (unlikely(!headroom_ok)) {
+			for (int j = 0; j < 4; j++)
+				vpush_one(pkts[j], vlan_tag, qinq_tag);
+			continue;
+		}
 
-	for (int i = 0; i < cnt; i++) {
-		struct snbuf *pkt = batch->pkts[i];
-		char *new_head;
-		__m128i ethh;
-		uint16_t tpid;
+		/* already tagged frames get an S-tag (QinQ) */
+		ctagged = vlan_ctagged_mask_x4(vlan_gather_x4(heads));
 
-		if ((new_head = snb_prepend(pkt, 4)) != NULL) {
-			/* shift 12 bytes to the left by 4 bytes */
-			ethh = _mm_loadu_si128((__m128i *)(new_head + 4));
-			tpid = _mm_extract_epi16(ethh, 6);
+		for (int j = 0; j < 4; j++) {
+			struct snbuf *pkt = pkts[j];
+			int t = (ctagged >> j) & 1;
+			uint32_t tag = vlan_tag ^ ((vlan_tag ^ qinq_tag) & -t);
+			__m128i ethh;
 
-			ethh = _mm_insert_epi32(ethh, 
-					(tpid == rte_cpu_to_be_16(0x8100)) ?
-						qinq_tag : vlan_tag,
-					3);
+			ethh = _mm_loadu_si128((__m128i *)heads[j]);
+			ethh = _mm_insert_epi32(ethh, tag, 3);
+			_mm_storeu_si128((__m128i *)(heads[j] - 4), ethh);
 
-			_mm_storeu_si128((__m128i *)new_head, ethh);
+			pkt->mbuf.data_off -= 4;
+			pkt->mbuf.data_len += 4;
+			pkt->mbuf.pkt_len += 4;
 		}
 	}
+#endif
+
+	for (; i < cnt; i++)
+		vpush_one(batch->pkts[i], vlan_tag, qinq_tag);
 		
 	run_next_module(m, batch);
 }
@@ -1,35 +1,81 @@
 #include <string.h>
 
 #include "../module.h"
+#include "../utils/vlan.h"
+
+/* returns the VID of the removed tag, or 0 if untagged */
+static inline gate_t vsplit_one(struct snbuf *pkt)
+{
+	char *old_head = snb_head_data(pkt);
+	__m128i ethh;
+	uint16_t tpid;
+	uint16_t tci;
+	int tagged;
+
+	ethh = _mm_loadu_si128((__m128i *)old_head);
+	tpid = _mm_extract_epi16(ethh, 6);
+
+	tagged = (tpid == rte_cpu_to_be_16(0x8100)) ||
+			(tpid == rte_cpu_to_be_16(0x88a8));
+
+	if (tagged && snb_adj(pkt, 4)) {
+		tci = _mm_extract_epi16(ethh, 7);
+		ethh = _mm_slli_si128(ethh, 4);
+		_mm_storeu_si128((__m128i *)old_head, ethh);
+		return rte_be_to_cpu_16(tci) & 0x0fff;
+	}
+
+	return 0;	/* untagged packets go to gate 0 */
+}
 
 static void vsplit_process_batch(struct module *m, struct pkt_batch *batch)
 {
 	gate_t vid[MAX_PKT_BURST];
 	int cnt = batch->cnt;
+	int i = 0;
 
-	for (int i = 0; i < cnt; i++) {
-		struct snbuf *pkt = batch->pkts[i];
-		char *old_head = snb_head_data(pkt);
-		__m128i ethh;
-		uint16_t tpid;
-		uint16_t tci;
+#if __AVX2__
+	for (; i + 4 <= cnt; i += 4) {
+		snb_array_t pkts = &batch->pkts[i];
+		char *heads[4];
+		uint64_t vids[4] __ymm_aligned;
+		int len_ok = 1;
 		int tagged;
+		__m256i w;
+
+		for (int j = 0; j < 4; j++) {
+			heads[j] = snb_head_data(pkts[j]);
+			len_ok &= (snb_head_len(pkts[j]) >= 4);
+		}
+
+		if (unlikely(!len_ok)) {
+			for (int j = 0; j < 4; j++)
+				vid[i + j] = vsplit_one(pkts[j]);
+			continue;
+		}
+
+		w = vlan_gather_x4(heads);
+		tagged = vlan_tagged_mask_x4(w);
+		_mm256_store_si256((__m256i *)vids, vlan_vid_x4(w));
 
-		ethh = _mm_loadu_si128((__m128i *)old_head);
-		tpid = _mm_extract_epi16(ethh, 6);
+		for (int j = 0; j < 4; j++) {
+			struct snbuf *pkt = pkts[j];
+			int t = (tagged >> j) & 1;
 
-		tagged = (tpid == rte_cpu_to_be_16(0x8100)) ||
-				(tpid == rte_cpu_to_be_16(0x88a8));
+			vlan_strip_hdr(heads[j], t);
 
-		if (tagged && snb_adj(pkt, 4)) {
-			tci = _mm_extract_epi16(ethh, 7);
-			ethh = _mm_slli_si128(ethh, 4);
-			_mm_storeu_si128((__m128i *)old_head, ethh);
-			vid[i] = rte_be_to_cpu_16(tci) & 0x0fff;
-		} else
-			vid[i] = 0;	/* untagged packets go to gate 0 */
+			pkt->mbuf.data_off += t << 2;
+			pkt->mbuf.data_len -= t << 2;
+			pkt->mbuf.pkt_len -= t << 2;
+
+			vid[i + j] = vids[j] & -t;
+		}
 	}
-	
+#endif
+
+	for (; i < cnt; i++)
+		vid[i] = vsplit_one(batch->pkts[i]);
+
 	run_split(m, vid, batch);
 }
 
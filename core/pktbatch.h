@@ -5,7 +5,17 @@
 
 #include <rte_memcpy.h>
 
+#include "common.h"
+
+/* Batch capacity. Build with "make BATCH_SIZE=n" for other widths */
+#ifndef MAX_PKT_BURST
 #define MAX_PKT_BURST			32
+#endif
+
+/* A power of 2, e.g., for the queue size of Merge. Capped at 128, since
+ * run_split() keeps MAX_PKT_BURST batches on the stack (~130KB at 128) */
+ct_assert(MAX_PKT_BURST >= 4 && MAX_PKT_BURST <= 128);
+ct_assert((MAX_PKT_BURST & (MAX_PKT_BURST - 1)) == 0);
 
 struct snbuf;
 
@@ -7,6 +7,8 @@
 #include "log.h"
 #include "snobj.h"
 #include "driver.h"
+#include "snbuf.h"
+#include "pktbatch.h"
 
 #define PORT_NAME_LEN		128
 
@@ -42,6 +44,8 @@ struct port {
 	/* for stats that do NOT belong to any queues */
 	port_stats_t port_stats;	
 
+	int multiseg;		/* can send chained snbufs? set by the driver */
+
 	void *priv[0];	
 };
 
@@ -50,6 +54,34 @@ static inline void *get_port_priv(struct port *p)
 	return (void *)(p + 1);
 }
 
+/* Drops (and counts) chained snbufs in the batch, unless the port can
+ * send them. Called by output modules before send_pkts() */
+static inline void port_drop_chained(struct port *p, queue_t qid,
+		struct pkt_batch *batch)
+{
+	struct snbuf *chained[MAX_PKT_BURST];
+	int num_chained = 0;
+	int cnt = 0;
+
+	if (p->multiseg)
+		return;
+
+	for (int i = 0; i < batch->cnt; i++) {
+		struct snbuf *pkt = batch->pkts[i];
+
+		if (unlikely(!snb_is_linear(pkt)))
+			chained[num_chained++] = pkt;
+		else
+			batch->pkts[cnt++] = pkt;
+	}
+
+	if (unlikely(num_chained)) {
+		batch->cnt = cnt;
+		p->queue_stats[PACKET_DIR_OUT][qid].dropped += num_chained;
+		snb_free_bulk(chained, num_chained);
+	}
+}
+
 size_t list_ports(const struct port **p_arr, size_t arr_size, size_t offset);
 struct port *find_port(const char *name);
 
@@ -0,0 +1,217 @@
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+
+#include "module.h"
+#include "namespace.h"
+#include "profile.h"
+#include "time.h"
+
+struct profile_rec {
+	struct module *from;	/* NULL if the call is the task itself */
+	struct module *to;
+	gate_t ogate;
+	uint16_t pkts;
+	uint64_t cycles;	/* including downstream modules */
+	uint64_t self_cycles;	/* excluding downstream modules */
+};
+
+/* Single producer (the worker) and single consumer (the master) */
+struct profile_ring {
+	volatile uint64_t head;		/* free-running indices */
+	uint64_t tail;
+
+	uint64_t lost;
+
+	struct profile_rec recs[PROFILE_RING_SIZE] __cacheline_aligned;
+};
+
+volatile uint32_t profile_one_in;
+__thread uint32_t profile_countdown;
+
+static struct profile_ring *rings[MAX_WORKERS];
+
+/* cycles of nested calls, for each depth */
+static __thread int depth;
+static __thread uint64_t child_cycles[PROFILE_MAX_DEPTH + 1];
+
+static inline void record(struct module *from, gate_t ogate,
+		struct module *to, uint16_t pkts,
+		uint64_t cycles, uint64_t self_cycles)
+{
+	struct profile_ring *ring = rings[ctx.wid];
+	uint64_t head = ring->head;
+	struct profile_rec *rec = &ring->recs[head & (PROFILE_RING_SIZE - 1)];
+
+	rec->from = from;
+	rec->to = to;
+	rec->ogate = ogate;
+	rec->pkts = pkts;
+	rec->cycles = cycles;
+	rec->self_cycles = self_cycles;
+
+	STORE_BARRIER();
+	ring->head = head + 1;
+}
+
+struct task_result profile_task(struct task *t)
+{
+	struct task_result ret;
+	uint64_t start;
+	uint64_t cycles;
+
+	depth = 0;
+	child_cycles[0] = 0;
+
+	ctx.profiling = 1;
+
+	start = rdtsc();
+	ret = task_scheduled(t);
+	cycles = rdtsc() - start;
+
+	ctx.profiling = 0;
+
+	record(NULL, 0, t->m, ret.packets, cycles, cycles - child_cycles[0]);
+
+	return ret;
+}
+
+void run_gate_profiled(struct module *m, gate_t ogate,
+		struct pkt_batch *batch)
+{
+	struct output_gate *gate = &m->gates[ogate];
+	uint16_t pkts = batch->cnt;	/* the callee may modify the batch */
+	uint64_t start;
+	uint64_t cycles;
+
+	if (unlikely(depth >= PROFILE_MAX_DEPTH)) {
+		__run_gate(gate, batch);
+		return;
+	}
+
+	depth++;
+	child_cycles[depth] = 0;
+
+	start = rdtsc();
+	__run_gate(gate, batch);
+	cycles = rdtsc() - start;
+
+	depth--;
+	child_cycles[depth] += cycles;
+
+	record(m, ogate, gate->m, pkts, cycles,
+			cycles - child_cycles[depth + 1]);
+}
+
+static void reset_stats(void)
+{
+	struct ns_iter iter;
+	struct module *m;
+
+	ns_init_iterator(&iter, NS_TYPE_MODULE);
+
+	while ((m = (struct module *)ns_next(&iter)) != NULL) {
+		memset(&m->prof, 0, sizeof(m->prof));
+
+		for (gate_t i = 0; i < m->allocated_gates; i++)
+			memset(&m->gates[i].prof, 0, sizeof(m->gates[i].prof));
+	}
+
+	ns_release_iterator(&iter);
+}
+
+int profile_enable(uint32_t one_in)
+{
+	profile_one_in = 0;
+
+	if (one_in == 0)
+		return 0;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		if (rings[wid])
+			continue;
+
+		rings[wid] = rte_zmalloc("profile", sizeof(*rings[wid]), 0);
+		if (!rings[wid])
+			return -ENOMEM;
+	}
+
+	/* records of the previous run are still being written, if any */
+	profile_collect();
+	reset_stats();
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		rings[wid]->lost = 0;
+
+	STORE_BARRIER();
+	profile_one_in = one_in;
+
+	return 0;
+}
+
+static void aggregate(const struct profile_rec *rec)
+{
+	struct profile_stats *stats = &rec->to->prof;
+
+	stats->batches++;
+	stats->pkts += rec->pkts;
+	stats->cycles += rec->self_cycles;
+
+	if (rec->from && rec->ogate < rec->from->allocated_gates) {
+		stats = &rec->from->gates[rec->ogate].prof;
+
+		stats->batches++;
+		stats->pkts += rec->pkts;
+		stats->cycles += rec->cycles;
+	}
+}
+
+uint64_t profile_collect(void)
+{
+	uint64_t lost = 0;
+
+	for (int wid = 0; wid < MAX_WORKERS; wid++) {
+		struct profile_ring *ring = rings[wid];
+		uint64_t head;
+		uint64_t tail;
+
+		if (!ring)
+			continue;
+
+		head = ring->head;
+		LOAD_BARRIER();
+
+		tail = ring->tail;
+		if (head - tail > PROFILE_RING_SIZE) {
+			ring->lost += head - tail - PROFILE_RING_SIZE;
+			tail = head - PROFILE_RING_SIZE;
+		}
+
+		for (; tail < head; tail++) {
+			struct profile_rec rec;
+
+			rec = ring->recs[tail & (PROFILE_RING_SIZE - 1)];
+
+			/* overwritten while being read? */
+			LOAD_BARRIER();
+			if (ring->head - tail >= PROFILE_RING_SIZE) {
+				ring->lost++;
+				continue;
+			}
+
+			aggregate(&rec);
+		}
+
+		ring->tail = head;
+		lost += ring->lost;
+	}
+
+	return lost;
+}
+
+void profile_discard(void)
+{
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		if (rings[wid])
+			rings[wid]->tail = rings[wid]->head;
+}
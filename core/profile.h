@@ -0,0 +1,66 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+#include <rte_branch_prediction.h>
+
+#include "common.h"
+#include "task.h"
+
+/* Sampled module profiler, enabled at runtime.
+ *
+ * For 1 in 'one_in' task invocations, the task and every gate call it makes
+ * (run_choose_module()) are timed with rdtsc. Each call is recorded in a
+ * per-worker ring, which the master drains and aggregates on demand
+ * (profile_collect()) into:
+ *   - per module: cycles spent in the module itself (excluding downstream)
+ *   - per output gate: cycles spent in the whole downstream of the gate
+ * The ring is lossy; records are overwritten if not collected in time. */
+
+#define PROFILE_RING_SIZE	4096	/* must be a power of 2 */
+#define PROFILE_MAX_DEPTH	32
+
+struct profile_stats {
+	uint64_t batches;
+	uint64_t pkts;
+	uint64_t cycles;
+};
+
+extern volatile uint32_t profile_one_in;	/* 0 if disabled */
+extern __thread uint32_t profile_countdown;
+
+/* Should the next task invocation be profiled? */
+static inline int profile_sample(void)
+{
+	if (likely(!profile_one_in))
+		return 0;
+
+	if (profile_countdown > 1) {
+		profile_countdown--;
+		return 0;
+	}
+
+	profile_countdown = profile_one_in;
+	return 1;
+}
+
+/* invoked by workers, instead of task_scheduled() if sampled */
+struct task_result profile_task(struct task *t);
+
+/* ------------------------------------------------------------------------
+ * functions below are invoked by the master
+ * ------------------------------------------------------------------------ */
+
+/* Resets all aggregated stats. one_in == 0 disables the profiler */
+int profile_enable(uint32_t one_in);
+
+/* Drains the rings of all workers into the stats of modules and gates.
+ * Returns the number of records lost so far */
+uint64_t profile_collect(void);
+
+/* Discards the records in rings. Workers must be paused
+ * (e.g., modules are being destroyed) */
+void profile_discard(void);
+
+#endif
@@ -1,6 +1,10 @@
 #include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include <rte_errno.h>
+#include <rte_malloc.h>
 
 #include <sn.h>
 
@@ -17,36 +21,136 @@ struct rte_mbuf pframe_template;
 
 static struct rte_mempool *pframe_pool[RTE_MAX_NUMA_NODES];
 
-/* per-packet initializer for mempool */
-static void snbuf_pkt_init(struct rte_mempool *mp, void *opaque_arg,
-		void *_m, unsigned i)
+/* Per-packet initializer. Same as rte_pktmbuf_init() but it does not zero
+ * the whole buffer (2KB), which used to dominate the startup time. Only the
+ * mbuf and immutable fields are initialized; _data, metadata, and
+ * scratchpad are always written before being read. */
+static void snbuf_pkt_init(struct rte_mempool *mp, struct snbuf *snb, int sid)
 {
-	struct snbuf *snb;
+	struct rte_mbuf *mbuf = &snb->mbuf;
 	struct snbuf_immutable *immutable;
+	phys_addr_t paddr = rte_mempool_virt2phy(mp, snb);
+	size_t stride = mp->header_size + mp->elt_size + mp->trailer_size;
 
-	snb = _m;
-	immutable = (struct snbuf_immutable *)&snb->immutable;
+	memset(mbuf, 0, sizeof(struct rte_mbuf));
 
-	rte_pktmbuf_init(mp, NULL, _m, i);
+	mbuf->priv_size = SNBUF_RESERVE;
+	mbuf->buf_addr = snb->_headroom;
+	mbuf->buf_physaddr = paddr + offsetof(struct snbuf, _headroom);
+	mbuf->buf_len = SNBUF_HEADROOM + SNBUF_DATA;
+	mbuf->data_off = SNBUF_HEADROOM;
+	mbuf->pool = mp;
+	mbuf->nb_segs = 1;
+	mbuf->port = 0xff;
 
-	memset(snb->_reserve, 0, SNBUF_RESERVE);
+	immutable = (struct snbuf_immutable *)&snb->immutable;
+	memset(immutable, 0, SNBUF_IMMUTABLE);
 
 	immutable->vaddr = snb;
-	immutable->paddr = rte_mempool_virt2phy(mp, snb);
-	immutable->sid = (uint32_t)(uint64_t)opaque_arg;
-	immutable->index = i;
+	immutable->paddr = paddr;
+	immutable->sid = sid;
+	immutable->index = ((uintptr_t)snb - mp->elt_va_start) / stride;
 
 	snb->simple = 1;
 }
 
+#define MAX_INIT_THREADS	8
+
+struct pkt_init_arg {
+	struct rte_mempool *pool;
+	int sid;
+	struct snbuf **snbs;
+	uint32_t begin;
+	uint32_t end;
+};
+
+static void *pkt_init_thread(void *_arg)
+{
+	struct pkt_init_arg *arg = _arg;
+
+	for (uint32_t i = arg->begin; i < arg->end; i++)
+		snbuf_pkt_init(arg->pool, arg->snbs[i], arg->sid);
+
+	return NULL;
+}
+
+/* Initializes all buffers in the pool, in parallel */
+static void init_pkts(struct rte_mempool *pool, int sid)
+{
+	struct pkt_init_arg args[MAX_INIT_THREADS];
+	pthread_t threads[MAX_INIT_THREADS];
+	int spawned[MAX_INIT_THREADS] = {0};
+	struct snbuf **snbs;
+	uint32_t n = pool->size;
+	int num_threads;
+	int ret;
+
+	num_threads = RTE_MIN(sysconf(_SC_NPROCESSORS_ONLN), MAX_INIT_THREADS);
+	num_threads = RTE_MAX(num_threads, 1);
+
+	snbs = malloc(sizeof(struct snbuf *) * n);
+	if (!snbs) {
+		log_crit("Cannot allocate memory for packet initialization\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* larger than the cache, so it directly comes from the ring */
+	ret = rte_mempool_get_bulk(pool, (void **)snbs, n);
+	assert(ret == 0);
+
+	for (int i = 0; i < num_threads; i++) {
+		args[i] = (struct pkt_init_arg) {
+			.pool = pool,
+			.sid = sid,
+			.snbs = snbs,
+			.begin = (uint64_t)n * i / num_threads,
+			.end = (uint64_t)n * (i + 1) / num_threads,
+		};
+
+		/* the last one (or any failed to spawn) runs in this thread */
+		if (i < num_threads - 1)
+			spawned[i] = !pthread_create(&threads[i], NULL,
+					pkt_init_thread, &args[i]);
+
+		if (!spawned[i])
+			pkt_init_thread(&args[i]);
+	}
+
+	for (int i = 0; i < num_threads; i++)
+		if (spawned[i])
+			pthread_join(threads[i], NULL);
+
+	rte_mempool_put_bulk(pool, (void **)snbs, n);
+
+	free(snbs);
+}
+
+/* Skips attempts that cannot succeed with the free memory of the socket.
+ * They fail only after reserving a memzone, which is slow when hugepages
+ * are fragmented */
+static int initial_pool_size(int sid, int size, int minimum)
+{
+	struct rte_malloc_socket_stats stats;
+	size_t per_pkt = sizeof(struct snbuf) + RTE_CACHE_LINE_SIZE;
+
+	if (rte_malloc_get_socket_stats(sid, &stats) != 0)
+		return size;
+
+	while (size > minimum && (size_t)size * per_pkt > stats.greatest_free_size)
+		size /= 2;
+
+	return size;
+}
+
 static void init_mempool_socket(int sid)
 {
 	struct rte_pktmbuf_pool_private pool_priv;
 	char name[256];
+	double start = get_epoch_time();
 
-	const int initial_try = 524288;
-	const int minimum_try = 16384;
-	int current_try = initial_try;
+	const int initial_try = global_opts.pool_size ? : 524288;
+	const int minimum_try = RTE_MIN(16384, initial_try);
+	int current_try = initial_pool_size(sid, initial_try, minimum_try);
 
 	pool_priv.mbuf_data_room_size = SNBUF_HEADROOM + SNBUF_DATA;
 	pool_priv.mbuf_priv_size = SNBUF_RESERVE;
@@ -54,14 +158,15 @@ static void init_mempool_socket(int sid)
 again:
 	sprintf(name, "pframe%d_%dk", sid, (current_try + 1) / 1024);
 
-	/* 2^n - 1 is optimal according to the DPDK manual */
+	/* 2^n - 1 is optimal according to the DPDK manual.
+	 * Buffers are initialized afterwards by init_pkts() */
 	pframe_pool[sid] = rte_mempool_create(name, 
 			current_try - 1, 
 			sizeof(struct snbuf),
 			NUM_MEMPOOL_CACHE, 
 			sizeof(struct rte_pktmbuf_pool_private),
 			rte_pktmbuf_pool_init, &pool_priv,
-			snbuf_pkt_init, (void *)(int64_t)sid, 
+			NULL, NULL, 
 			sid, 0);
 
 	if (!pframe_pool[sid]) {
@@ -76,8 +181,10 @@ again:
 		exit(EXIT_FAILURE);
 	}
 
-	log_info("%d packet buffers allocated on socket %d\n", 
-			current_try - 1, sid);
+	init_pkts(pframe_pool[sid], sid);
+
+	log_info("%d packet buffers allocated on socket %d (%.3f sec)\n", 
+			current_try - 1, sid, get_epoch_time() - start);
 
 	if (global_opts.debug_mode)
 		rte_mempool_dump(stdout, pframe_pool[sid]);
@@ -99,6 +206,83 @@ static void init_templates(void)
 	}
 }
 
+struct snbuf_paddr_map snbuf_paddr_map;
+
+static void pool_paddr_range(struct rte_mempool *pool,
+		phys_addr_t *start, phys_addr_t *end)
+{
+	/* physically contiguous (see init_mempool_socket()) */
+	assert(pool->pg_num == 1);
+
+	*start = pool->elt_pa[0];
+	*end = *start + (pool->elt_va_end - pool->elt_va_start);
+}
+
+static void init_paddr_map(void)
+{
+	struct snbuf_paddr_map *map = &snbuf_paddr_map;
+	phys_addr_t lowest = UINT64_MAX;
+	phys_addr_t highest = 0;
+
+	for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+		phys_addr_t start;
+		phys_addr_t end;
+
+		if (!pframe_pool[i])
+			continue;
+
+		pool_paddr_range(pframe_pool[i], &start, &end);
+		lowest = RTE_MIN(lowest, start);
+		highest = RTE_MAX(highest, end);
+	}
+
+	map->base = lowest & ~((1ul << SNBUF_PADDR_SHIFT) - 1);
+	map->num_chunks = ((highest - map->base) >> SNBUF_PADDR_SHIFT) + 1;
+	map->chunks = rte_zmalloc("paddr_map", 
+			map->num_chunks * sizeof(uintptr_t), 0);
+	if (!map->chunks) {
+		log_crit("paddr_map allocation (%lu chunks) failed\n",
+				map->num_chunks);
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+		struct rte_mempool *pool = pframe_pool[i];
+		phys_addr_t start;
+		phys_addr_t end;
+
+		if (!pool)
+			continue;
+
+		pool_paddr_range(pool, &start, &end);
+
+		for (phys_addr_t pa = start; pa < end; ) {
+			uint64_t chunk = (pa - map->base) >> SNBUF_PADDR_SHIFT;
+			phys_addr_t chunk_pa = map->base + 
+				(chunk << SNBUF_PADDR_SHIFT);
+			phys_addr_t chunk_end = chunk_pa + 
+				(1ul << SNBUF_PADDR_SHIFT);
+			uintptr_t vaddr = pool->elt_va_start + 
+				(chunk_pa - start);
+
+			/* partially covered chunks (at most the first and
+			 * the last one) need the range check of the slow path */
+			if (pa > chunk_pa || end < chunk_end)
+				map->chunks[chunk] = SNBUF_PADDR_AMBIGUOUS;
+			else if (map->chunks[chunk] && 
+					map->chunks[chunk] != vaddr)
+				map->chunks[chunk] = SNBUF_PADDR_AMBIGUOUS;
+			else
+				map->chunks[chunk] = vaddr;
+
+			pa = chunk_end;
+		}
+	}
+
+	log_info("paddr_map: %lu chunks from 0x%lx\n", 
+			map->num_chunks, map->base);
+}
+
 void init_mempool(void)
 {
 	int initialized[RTE_MAX_NUMA_NODES];
@@ -125,6 +309,7 @@ void init_mempool(void)
 	}
 
 	init_templates();
+	init_paddr_map();
 }
 
 void close_mempool(void)
@@ -142,7 +327,7 @@ struct rte_mempool *get_pframe_pool_socket(int socket)
 	return pframe_pool[socket];
 }
 
-struct snbuf *paddr_to_snb(phys_addr_t paddr)
+struct snbuf *__paddr_to_snb(phys_addr_t paddr)
 {
 	struct snbuf *ret = NULL;
 
@@ -151,17 +336,12 @@ struct snbuf *paddr_to_snb(phys_addr_t paddr)
 
 		phys_addr_t pg_start;
 		phys_addr_t pg_end;
-		uintptr_t size;
 
 		pool = pframe_pool[i];
 		if (!pool)
 			continue;
 
-		assert(pool->pg_num == 1);
-
-		pg_start = pool->elt_pa[0];
-		size = pool->elt_va_end - pool->elt_va_start;
-		pg_end = pg_start + size;
+		pool_paddr_range(pool, &pg_start, &pg_end);
 
 		if (pg_start <= paddr && paddr < pg_end) {
 			uintptr_t offset;
@@ -180,6 +360,170 @@ struct snbuf *paddr_to_snb(phys_addr_t paddr)
 	return ret;
 }
 
+/* returns the segment containing offset, and the offset within it */
+static struct rte_mbuf *find_seg(struct snbuf *snb, uint32_t *offset)
+{
+	struct rte_mbuf *seg = &snb->mbuf;
+
+	while (*offset >= seg->data_len && seg->next) {
+		*offset -= seg->data_len;
+		seg = seg->next;
+	}
+
+	return seg;
+}
+
+void __snb_read(struct snbuf *snb, uint32_t offset, uint32_t len, void *buf)
+{
+	struct rte_mbuf *seg = find_seg(snb, &offset);
+
+	while (len > 0) {
+		uint32_t copy = RTE_MIN(len, (uint32_t)seg->data_len - offset);
+
+		rte_memcpy(buf, rte_pktmbuf_mtod(seg, char *) + offset, copy);
+
+		buf = (char *)buf + copy;
+		len -= copy;
+		offset = 0;
+		seg = seg->next;
+	}
+}
+
+void __snb_write(struct snbuf *snb, uint32_t offset, uint32_t len,
+		const void *buf)
+{
+	struct rte_mbuf *seg = find_seg(snb, &offset);
+
+	while (len > 0) {
+		uint32_t copy = RTE_MIN(len, (uint32_t)seg->data_len - offset);
+
+		rte_memcpy(rte_pktmbuf_mtod(seg, char *) + offset, buf, copy);
+
+		buf = (const char *)buf + copy;
+		len -= copy;
+		offset = 0;
+		seg = seg->next;
+	}
+}
+
+int snb_extend(struct snbuf *snb, uint32_t len)
+{
+	struct rte_mbuf *head = &snb->mbuf;
+	struct rte_mbuf *last = rte_pktmbuf_lastseg(head);
+	struct rte_mbuf *tail = last;
+	uint16_t last_len = last->data_len;
+	uint32_t remaining = len;
+	int new_segs = 0;
+
+	while (remaining > 0) {
+		uint32_t room = rte_pktmbuf_tailroom(tail);
+
+		if (room == 0) {
+			struct rte_mbuf *seg;
+
+			if (head->nb_segs + new_segs >= UINT8_MAX)
+				goto fail;
+
+			seg = rte_pktmbuf_alloc(head->pool);
+			if (!seg)
+				goto fail;
+
+			tail->next = seg;
+			tail = seg;
+			new_segs++;
+			continue;
+		}
+
+		room = RTE_MIN(room, remaining);
+		tail->data_len += room;
+		remaining -= room;
+	}
+
+	head->nb_segs += new_segs;
+	head->pkt_len += len;
+
+	return 0;
+
+fail:
+	if (last->next)
+		rte_pktmbuf_free(last->next);
+
+	last->next = NULL;
+	last->data_len = last_len;
+
+	return -ENOMEM;
+}
+
+struct snbuf *__snb_copy_chain(struct snbuf *src)
+{
+	struct snbuf *dst;
+	uint32_t offset = 0;
+
+	dst = __snb_alloc_pool(src->mbuf.pool);
+	if (!dst)
+		return NULL;
+
+	if (snb_extend(dst, snb_total_len(src)) < 0) {
+		snb_free(dst);
+		return NULL;
+	}
+
+	for (struct rte_mbuf *seg = &src->mbuf; seg; seg = seg->next) {
+		__snb_write(dst, offset, seg->data_len,
+				rte_pktmbuf_mtod(seg, char *));
+		offset += seg->data_len;
+	}
+
+	return dst;
+}
+
+#define FREE_BULK_MAX_POOLS	4
+#define FREE_BULK_CHUNK		64
+
+void __snb_free_bulk_mixed(snb_array_t snbs, int cnt)
+{
+	struct rte_mempool *pools[FREE_BULK_MAX_POOLS];
+	void *objs[FREE_BULK_MAX_POOLS][FREE_BULK_CHUNK];
+	int num_objs[FREE_BULK_MAX_POOLS];
+
+	for (int base = 0; base < cnt; base += FREE_BULK_CHUNK) {
+		int end = RTE_MIN(cnt, base + FREE_BULK_CHUNK);
+		int num_pools = 0;
+
+		for (int i = base; i < end; i++) {
+			struct snbuf *snb = snbs[i];
+			struct rte_mempool *pool = snb->mbuf.pool;
+			int j;
+
+			if (unlikely(!snb_is_simple(snb) ||
+					rte_mbuf_refcnt_read(&snb->mbuf) != 1)) {
+				snb_free(snb);
+				continue;
+			}
+
+			for (j = 0; j < num_pools; j++)
+				if (pools[j] == pool)
+					break;
+
+			if (j == num_pools) {
+				if (unlikely(num_pools == FREE_BULK_MAX_POOLS)) {
+					snb_free(snb);
+					continue;
+				}
+
+				pools[num_pools] = pool;
+				num_objs[num_pools] = 0;
+				num_pools++;
+			}
+
+			objs[j][num_objs[j]++] = snb;
+		}
+
+		for (int j = 0; j < num_pools; j++)
+			rte_mempool_put_bulk(pools[j], objs[j], num_objs[j]);
+	}
+}
+
 void snb_dump(FILE *file, struct snbuf *pkt)
 {
 	struct rte_mbuf *mbuf;
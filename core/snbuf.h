@@ -39,6 +39,10 @@ ct_assert(SNBUF_HEADROOM == RTE_PKTMBUF_HEADROOM);
  *  * When packets are newly allocated, the data should be filled from _data.
  *  * The packet data may reside in the _headroom + _data area, 
  *    but its size must not exceed 1536 (SNBUF_DATA) when passed to a port.
+ *  * Larger packets (e.g., jumbo frames) are chained snbufs. Only ports
+ *    configured for them (see the 'mtu' option of PMD ports) can send them.
+ *    Others drop them (see port_drop_chained()).
+ *  * Modules that overwrite a whole packet must snb_free_tail() first.
  */
 struct snbuf {
 	union {
@@ -117,6 +121,22 @@ static inline int snb_is_linear(struct snbuf *snb)
 	return rte_pktmbuf_is_contiguous(&snb->mbuf);
 }
 
+/* Frees all segments but the first one, so that snb is a single-segment
+ * packet with the data of the first segment only */
+static inline void snb_free_tail(struct snbuf *snb)
+{
+	struct rte_mbuf *tail = snb->mbuf.next;
+
+	if (likely(!tail))
+		return;
+
+	snb->mbuf.next = NULL;
+	snb->mbuf.nb_segs = 1;
+	snb->mbuf.pkt_len = snb->mbuf.data_len;
+
+	rte_pktmbuf_free(tail);
+}
+
 /* single segment and direct? */
 static inline int snb_is_simple(struct snbuf *snb)
 {
@@ -146,11 +166,28 @@ static inline struct snbuf *snb_alloc()
 	return snb;
 }
 
+/* Is the buffer from another socket than the current worker's?
+ * (e.g., received from a NIC attached to the other socket)
+ * Only the address is checked against the local pool, so no cache line of
+ * the packet is touched (mbuf.pool is on the second one) */
+static inline int snb_is_remote(struct snbuf *snb)
+{
+	const struct rte_mempool *pool = ctx.pframe_pool;
+
+	return (uintptr_t)snb - pool->elt_va_start >=
+			pool->elt_va_end - pool->elt_va_start;
+}
+
 static inline void snb_free(struct snbuf *snb)
 {
 	rte_pktmbuf_free((struct rte_mbuf *)snb);
 }
 
+/* Slow path of snb_free_bulk(), for batches with packets from multiple
+ * pools (e.g., from both sockets) and/or non-simple packets.
+ * Simple packets are put back with one rte_mempool_put_bulk() per pool. */
+void __snb_free_bulk_mixed(snb_array_t snbs, int cnt);
+
 #if __AVX__
 #  include "snbuf_avx.h"
 #else
@@ -198,8 +235,7 @@ static inline void snb_free_bulk(snb_array_t snbs, int cnt)
 	return;
 
 slow_path:
-	for (i = 0; i < cnt; i++)
-		snb_free(snbs[i]);
+	__snb_free_bulk_mixed(snbs, cnt);
 }
 #endif
 
@@ -244,13 +280,64 @@ static inline void snb_trim(struct snbuf *snb, uint16_t to_remove)
 	assert(ret == 0);
 }
 
+/* Multi-segment (chained) packets, e.g., jumbo frames.
+ * Headers are expected to reside in the first segment, so most modules can
+ * keep using snb_head_data(). Use the functions below to access the data
+ * beyond the first segment. Each has a fast path for linear packets. */
+
+/* slow paths. see below */
+void __snb_read(struct snbuf *snb, uint32_t offset, uint32_t len, void *buf);
+void __snb_write(struct snbuf *snb, uint32_t offset, uint32_t len,
+		const void *buf);
+struct snbuf *__snb_copy_chain(struct snbuf *src);
+
+/* Appends len bytes to the end, chaining new segments if the last segment
+ * runs out of tailroom. Returns 0, or -ENOMEM with the packet unchanged */
+int snb_extend(struct snbuf *snb, uint32_t len);
+
+/* Returns a pointer to the len bytes at offset. If they span segments,
+ * they are copied into buf (at least len bytes) and buf is returned.
+ * NULL if out of range */
+static inline const void *snb_read(struct snbuf *snb, uint32_t offset,
+		uint32_t len, void *buf)
+{
+	if (likely(offset + len <= snb_head_len(snb)))
+		return snb_head_data(snb) + offset;
+
+	if (unlikely(offset + len > snb_total_len(snb)))
+		return NULL;
+
+	__snb_read(snb, offset, len, buf);
+	return buf;
+}
+
+/* Overwrites the len bytes at offset. -EINVAL if out of range */
+static inline int snb_write(struct snbuf *snb, uint32_t offset,
+		uint32_t len, const void *buf)
+{
+	if (likely(offset + len <= snb_head_len(snb))) {
+		rte_memcpy(snb_head_data(snb) + offset, buf, len);
+		return 0;
+	}
+
+	if (unlikely(offset + len > snb_total_len(snb)))
+		return -EINVAL;
+
+	__snb_write(snb, offset, len, buf);
+	return 0;
+}
+
+/* Returns a deep copy of the packet (NULL if out of buffers) */
 static inline struct snbuf *snb_copy(struct snbuf *src)
 {
 	struct snbuf *dst;
 
-	assert(snb_is_linear(src));
+	if (unlikely(!snb_is_linear(src)))
+		return __snb_copy_chain(src);
 
 	dst = __snb_alloc_pool(src->mbuf.pool);
+	if (unlikely(!dst))
+		return NULL;
 
 	rte_memcpy(snb_append(dst, snb_total_len(src)),
 			snb_head_data(src),
@@ -277,8 +364,48 @@ static inline phys_addr_t snb_to_paddr(struct snbuf *snb)
 	return snb->immutable.paddr;
 }
 
-/* Slow. Do not use in the datapath */
-struct snbuf *paddr_to_snb(phys_addr_t paddr);
+/* paddr -> snbuf translation table. Each entry maps a 2MB chunk of the
+ * physical address space [base, base + num_chunks << SNBUF_PADDR_SHIFT) to
+ * the virtual address of the chunk start, if the chunk belongs to a pool */
+#define SNBUF_PADDR_SHIFT	21
+#define SNBUF_PADDR_AMBIGUOUS	1	/* partially covered by pool(s) */
+
+struct snbuf_paddr_map {
+	phys_addr_t base;
+	uint64_t num_chunks;
+	uintptr_t *chunks;
+};
+
+extern struct snbuf_paddr_map snbuf_paddr_map;
+
+/* slow path for ambiguous chunks */
+struct snbuf *__paddr_to_snb(phys_addr_t paddr);
+
+/* Returns NULL if paddr does not belong to any packet pool */
+static inline struct snbuf *paddr_to_snb(phys_addr_t paddr)
+{
+	const struct snbuf_paddr_map *map = &snbuf_paddr_map;
+	uint64_t chunk = (paddr - map->base) >> SNBUF_PADDR_SHIFT;
+	uintptr_t vaddr;
+	struct snbuf *snb;
+
+	if (unlikely(chunk >= map->num_chunks))
+		return NULL;
+
+	vaddr = map->chunks[chunk];
+	if (unlikely(vaddr <= SNBUF_PADDR_AMBIGUOUS)) {
+		if (!vaddr)
+			return NULL;
+
+		return __paddr_to_snb(paddr);
+	}
+
+	snb = (struct snbuf *)(vaddr + 
+			(paddr & ((1ul << SNBUF_PADDR_SHIFT) - 1)));
+	assert(snb_to_paddr(snb) == paddr);
+
+	return snb;
+}
 
 void snb_dump(FILE *file, struct snbuf *pkt);
 
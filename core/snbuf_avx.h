@@ -138,8 +138,7 @@ static inline void snb_free_bulk(snb_array_t snbs, int cnt)
 	return;
 
 slow_path:
-	for (i = 0; i < cnt; i++)
-		snb_free(snbs[i]);
+	__snb_free_bulk_mixed(snbs, cnt);
 }
 
 #endif
@@ -79,6 +79,77 @@ static struct snobj *handle_reset_workers(struct snobj *q)
 	return NULL;
 }
 
+static const char *idle_modes[] = {
+	[IDLE_MODE_SPIN] = "spin",
+	[IDLE_MODE_PAUSE] = "pause",
+	[IDLE_MODE_SLEEP] = "sleep",
+};
+
+static struct snobj *idle_info(const struct worker_context *w)
+{
+	struct snobj *r = snobj_map();
+	uint64_t wakeups = w->idle_stats.wakeups;
+
+	snobj_map_set(r, "mode", snobj_str(idle_modes[w->idle_mode]));
+	snobj_map_set(r, "sleep_rounds", snobj_uint(w->idle_sleep_rounds));
+	snobj_map_set(r, "max_sleep_us", snobj_uint(w->idle_max_sleep_us));
+	snobj_map_set(r, "sleeps", snobj_uint(w->idle_stats.sleeps));
+	snobj_map_set(r, "wakeups", snobj_uint(wakeups));
+	snobj_map_set(r, "avg_wakeup_ns", snobj_uint(wakeups ?
+			w->idle_stats.wakeup_cycles * 1000000000 / tsc_hz /
+				wakeups : 0));
+	snobj_map_set(r, "max_wakeup_ns", snobj_uint(
+			w->idle_stats.max_wakeup_cycles * 1000000000 / tsc_hz));
+	snobj_map_set(r, "max_oversleep_ns", snobj_uint(
+			w->idle_stats.max_oversleep_cycles * 1000000000 / 
+				tsc_hz));
+
+	return r;
+}
+
+/* Converts a TSC value of the past into the wall clock time */
+static double tsc_to_epoch(uint64_t tsc)
+{
+	return get_epoch_time() - (double)(rdtsc() - tsc) / tsc_hz;
+}
+
+static struct snobj *sched_stats_to_snobj(const struct sched *s)
+{
+	struct sched_snapshot snap;
+	struct snobj *r = snobj_map();
+	struct snobj *rates = snobj_map();
+
+	sched_get_snapshot(s, &snap);
+
+	snobj_map_set(r, "timestamp", snobj_double(snap.tsc ? 
+				tsc_to_epoch(snap.tsc) : get_epoch_time()));
+	snobj_map_set(r, "count", 
+			snobj_uint(snap.stats.usage[RESOURCE_CNT]));
+	snobj_map_set(r, "cycles", 
+			snobj_uint(snap.stats.usage[RESOURCE_CYCLE]));
+	snobj_map_set(r, "packets", 
+			snobj_uint(snap.stats.usage[RESOURCE_PACKET]));
+	snobj_map_set(r, "bits", 
+			snobj_uint(snap.stats.usage[RESOURCE_BIT]));
+	snobj_map_set(r, "idle_count", snobj_uint(snap.stats.cnt_idle));
+	snobj_map_set(r, "idle_cycles", snobj_uint(snap.stats.cycles_idle));
+
+	snobj_map_set(rates, "count", 
+			snobj_uint(snap.rates.usage[RESOURCE_CNT]));
+	snobj_map_set(rates, "cycles", 
+			snobj_uint(snap.rates.usage[RESOURCE_CYCLE]));
+	snobj_map_set(rates, "packets", 
+			snobj_uint(snap.rates.usage[RESOURCE_PACKET]));
+	snobj_map_set(rates, "bits", 
+			snobj_uint(snap.rates.usage[RESOURCE_BIT]));
+	snobj_map_set(rates, "idle_count", snobj_uint(snap.rates.cnt_idle));
+	snobj_map_set(rates, "idle_cycles", 
+			snobj_uint(snap.rates.cycles_idle));
+	snobj_map_set(r, "rates", rates);
+
+	return r;
+}
+
 static struct snobj *handle_list_workers(struct snobj *q)
 {
 	struct snobj *r;
@@ -97,10 +168,23 @@ static struct snobj *handle_list_workers(struct snobj *q)
 				snobj_int(is_worker_running(wid)));
 		snobj_map_set(worker, "core",
 				snobj_int(workers[wid]->core));
+		snobj_map_set(worker, "socket",
+				snobj_int(workers[wid]->socket));
 		snobj_map_set(worker, "num_tcs",
 				snobj_int(workers[wid]->s->num_classes));
 		snobj_map_set(worker, "silent_drops",
 				snobj_int(workers[wid]->silent_drops));
+		snobj_map_set(worker, "tcs_stolen",
+				snobj_uint(workers[wid]->s->cnt_stolen));
+		snobj_map_set(worker, "tcs_given",
+				snobj_uint(workers[wid]->s->cnt_given));
+		snobj_map_set(worker, "idle", idle_info(workers[wid]));
+		snobj_map_set(worker, "local_pkts", 
+				snobj_uint(workers[wid]->numa_stats.local_pkts));
+		snobj_map_set(worker, "remote_pkts", 
+				snobj_uint(workers[wid]->numa_stats.remote_pkts));
+		snobj_map_set(worker, "stats", sched_stats_to_snobj(
+					workers[wid]->s));
 
 		snobj_list_add(r, worker);
 	}
@@ -112,6 +196,7 @@ static struct snobj *handle_add_worker(struct snobj *q)
 {
 	unsigned int wid;
 	unsigned int core;
+	int ret;
 
 	struct snobj *t;
 
@@ -135,7 +220,65 @@ static struct snobj *handle_add_worker(struct snobj *q)
 	if (is_worker_active(wid))
 		return snobj_err(EEXIST, "worker:%d is already active", wid);
 
-	launch_worker(wid, core);
+	ret = launch_worker(wid, core);
+	if (ret < 0)
+		return snobj_errno(-ret);
+
+	return NULL;
+}
+
+static struct snobj *handle_set_worker_idle(struct snobj *q)
+{
+	unsigned int wid;
+	const char *mode_str;
+	int mode = -1;
+
+	int64_t sleep_rounds;
+	int64_t max_sleep_us;
+
+	int ret;
+
+	if (!snobj_eval_exists(q, "wid"))
+		return snobj_err(EINVAL, "Missing 'wid' field");
+
+	wid = snobj_eval_uint(q, "wid");
+	if (wid >= MAX_WORKERS)
+		return snobj_err(EINVAL, "'wid' must be between 0 and %d",
+				MAX_WORKERS - 1);
+
+	if (!is_worker_active(wid))
+		return snobj_err(ENOENT, "worker:%d does not exist", wid);
+
+	mode_str = snobj_eval_str(q, "mode");
+	if (!mode_str)
+		return snobj_err(EINVAL, "Missing 'mode' field");
+
+	for (int i = 0; i < sizeof(idle_modes) / sizeof(char *); i++)
+		if (strcmp(mode_str, idle_modes[i]) == 0)
+			mode = i;
+
+	if (mode < 0)
+		return snobj_err(EINVAL, "'mode' must be 'spin', 'pause', "
+				"or 'sleep'");
+
+	sleep_rounds = workers[wid]->idle_sleep_rounds;
+	if (snobj_eval_exists(q, "sleep_rounds"))
+		sleep_rounds = snobj_eval_int(q, "sleep_rounds");
+
+	max_sleep_us = workers[wid]->idle_max_sleep_us;
+	if (snobj_eval_exists(q, "max_sleep_us"))
+		max_sleep_us = snobj_eval_int(q, "max_sleep_us");
+
+	if (sleep_rounds < 1 || sleep_rounds > UINT32_MAX)
+		return snobj_err(EINVAL, "'sleep_rounds' must be a positive "
+				"integer");
+
+	if (max_sleep_us < 1 || max_sleep_us > 1000000)
+		return snobj_err(EINVAL, "'max_sleep_us' must be 1-1000000");
+
+	ret = set_worker_idle(wid, mode, sleep_rounds, max_sleep_us);
+	if (ret < 0)
+		return snobj_errno(-ret);
 
 	return NULL;
 }
@@ -185,6 +328,8 @@ static struct snobj *handle_reset_tcs(struct snobj *q)
 	return NULL;
 }
 
+/* Workers keep running. TCs being stolen or migrated may be detached
+ * (c->s and c->parent are NULL) at any moment, so each is read only once */
 static struct snobj *handle_list_tcs(struct snobj *q)
 {
 	struct snobj *r;
@@ -215,28 +360,55 @@ static struct snobj *handle_list_tcs(struct snobj *q)
 	ns_init_iterator(&iter, NS_TYPE_TC);
 
 	while ((c = (struct tc *)ns_next(&iter)) != NULL) {
-		int wid;
+		struct sched *s = *(struct sched * volatile *)&c->s;
+		struct tc *parent = *(struct tc * volatile *)&c->parent;
+		int wid = MAX_WORKERS;
 
 		if (wid_filter < MAX_WORKERS) {
-			if (workers[wid_filter]->s != c->s)
+			if (!s || workers[wid_filter]->s != s)
 				continue;
 			wid = wid_filter;
-		} else {
+		} else if (s) {
 			for (wid = 0; wid < MAX_WORKERS; wid++)
 				if (is_worker_active(wid) && 
-						workers[wid]->s == c->s)
+						workers[wid]->s == s)
 					break;
 		}
 		struct snobj *elem = snobj_map();
 
 		snobj_map_set(elem, "name", snobj_str(c->name));
 		snobj_map_set(elem, "tasks", snobj_int(c->num_tasks));
-		snobj_map_set(elem, "parent", snobj_str(c->parent->name));
+		/* detached TCs (being stolen or migrated) have no parent */
+		if (parent)
+			snobj_map_set(elem, "parent", 
+					snobj_str(parent->name));
+		else
+			snobj_map_set(elem, "parent", snobj_str("(in transit)"));
 		snobj_map_set(elem, "priority", snobj_int(c->priority));
+		snobj_map_set(elem, "burst", snobj_uint(c->burst));
+
+		if (c->quantum_tasks) {
+			snobj_map_set(elem, "quantum_tasks", 
+					snobj_uint(c->quantum_tasks));
+			snobj_map_set(elem, "quantum_ns", snobj_uint(
+					c->quantum_tsc * 1000000000 / 
+						tsc_hz));
+		}
+
+		if (c->edf.period_tsc) {
+			snobj_map_set(elem, "policy", snobj_str("edf"));
+			snobj_map_set(elem, "period_ns", snobj_uint(
+					c->edf.period_tsc * 1000000000 / 
+						tsc_hz));
+			snobj_map_set(elem, "deadline_misses", 
+					snobj_uint(c->edf.missed));
+		} else
+			snobj_map_set(elem, "policy", snobj_str("stride"));
+
 		// we list limit for each resource, reversing calculation from tc.c:tc_init()
 		for (int i = 0; i < NUM_RESOURCES; i++)
 		  snobj_map_set(elem, tc_limit_str[i],
-				snobj_int((c->tb[i].limit * (tsc_hz >> 4)) \
+				snobj_int((c->tb.limit[i] * (tsc_hz >> 4)) \
 					  >> (USAGE_AMPLIFIER_POW - 4)));
 
 		if (wid < MAX_WORKERS)
@@ -261,6 +433,7 @@ static struct snobj *handle_add_tc(struct snobj *q)
 	struct tc_params params;
 	struct tc *c;
 
+	const char *policy;
 	int64_t limit;
 	
 	tc_name = snobj_eval_str(q, "name");
@@ -291,6 +464,26 @@ static struct snobj *handle_add_tc(struct snobj *q)
 		return snobj_err(EINVAL, "Priority %d is reserved",
 				DEFAULT_PRIORITY);
 
+	params.migratable = snobj_eval_int(q, "migratable");
+	params.target_latency_ns = snobj_eval_uint(q, "target_latency_ns");
+
+	if (snobj_eval_uint(q, "quantum_tasks") > UINT32_MAX)
+		return snobj_err(EINVAL, "'quantum_tasks' is too large");
+
+	params.quantum_tasks = snobj_eval_uint(q, "quantum_tasks");
+	params.quantum_ns = snobj_eval_uint(q, "quantum_ns");
+	if (params.quantum_ns && !params.quantum_tasks)
+		params.quantum_tasks = UINT32_MAX;	/* bounded by time */
+
+	policy = snobj_eval_str(q, "policy") ? : "stride";
+	if (strcmp(policy, "edf") == 0) {
+		params.period_ns = snobj_eval_uint(q, "period_ns");
+		if (params.period_ns == 0)
+			return snobj_err(EINVAL, "'period_ns' must be given "
+					"for the 'edf' policy");
+	} else if (strcmp(policy, "stride") != 0)
+		return snobj_err(EINVAL, "'policy' must be 'stride' or 'edf'");
+
 	/* TODO: add support for other parameters */
 	params.share = 1;
 	params.share_resource = RESOURCE_CNT;
@@ -313,6 +506,42 @@ static struct snobj *handle_add_tc(struct snobj *q)
 	return NULL;
 }
 
+static struct snobj *stats_to_snobj(const struct tc_stats *stats)
+{
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "count", 
+			snobj_uint(stats->usage[RESOURCE_CNT]));
+	snobj_map_set(r, "cycles", 
+			snobj_uint(stats->usage[RESOURCE_CYCLE]));
+	snobj_map_set(r, "packets", 
+			snobj_uint(stats->usage[RESOURCE_PACKET]));
+	snobj_map_set(r, "bits", 
+			snobj_uint(stats->usage[RESOURCE_BIT]));
+	snobj_map_set(r, "throttled", 
+			snobj_uint(stats->cnt_throttled));
+
+	return r;
+}
+
+/* From the snapshot published by the worker, not from the live counters */
+static struct snobj *tc_stats_to_snobj(const struct tc *c)
+{
+	struct tc_snapshot snap;
+	struct snobj *r;
+
+	tc_get_snapshot(c, &snap);
+
+	r = stats_to_snobj(&snap.stats);
+	snobj_map_set(r, "timestamp", snobj_double(snap.tsc ? 
+				tsc_to_epoch(snap.tsc) : get_epoch_time()));
+	snobj_map_set(r, "rates", stats_to_snobj(&snap.rates));
+
+	return r;
+}
+
+/* Argument: a TC name (returns its stats), 
+ * or nil (returns a map of all TCs, by name) */
 static struct snobj *handle_get_tc_stats(struct snobj *q)
 {
 	const char *tc_name;
@@ -321,6 +550,21 @@ static struct snobj *handle_get_tc_stats(struct snobj *q)
 	
 	struct snobj *r;
 
+	if (!q || snobj_type(q) == TYPE_NIL) {
+		struct ns_iter iter;
+
+		r = snobj_map();
+
+		ns_init_iterator(&iter, NS_TYPE_TC);
+
+		while ((c = (struct tc *)ns_next(&iter)) != NULL)
+			snobj_map_set(r, c->name, tc_stats_to_snobj(c));
+
+		ns_release_iterator(&iter);
+
+		return r;
+	}
+
 	tc_name = snobj_str_get(q);
 	if (!tc_name)
 		return snobj_err(EINVAL, "Argument must be a name in str");
@@ -329,19 +573,97 @@ static struct snobj *handle_get_tc_stats(struct snobj *q)
 	if (!c)
 		return snobj_err(ENOENT, "No TC '%s' found", tc_name);
 
-	r = snobj_map();
+	return tc_stats_to_snobj(c);
+}
 
-	snobj_map_set(r, "timestamp", snobj_double(get_epoch_time()));
-	snobj_map_set(r, "count", 
-			snobj_uint(c->stats.usage[RESOURCE_CNT]));
-	snobj_map_set(r, "cycles", 
-			snobj_uint(c->stats.usage[RESOURCE_CYCLE]));
-	snobj_map_set(r, "packets", 
-			snobj_uint(c->stats.usage[RESOURCE_PACKET]));
-	snobj_map_set(r, "bits", 
-			snobj_uint(c->stats.usage[RESOURCE_BIT]));
+/* Unlike other TC commands, this does not pause workers */
+static struct snobj *handle_migrate_tc(struct snobj *q)
+{
+	const char *tc_name;
+	unsigned int wid;
+	int src_wid;
 
-	return r;
+	struct tc *c;
+	struct sched *dst;
+
+	double deadline;
+	int ret;
+
+	tc_name = snobj_eval_str(q, "name");
+	if (!tc_name)
+		return snobj_err(EINVAL, "Missing 'name' field");
+
+	c = ns_lookup(NS_TYPE_TC, tc_name);
+	if (!c)
+		return snobj_err(ENOENT, "No TC '%s' found", tc_name);
+
+	wid = snobj_eval_uint(q, "wid");
+	if (wid >= MAX_WORKERS)
+		return snobj_err(EINVAL, "'wid' must be between 0 and %d",
+				MAX_WORKERS - 1);
+
+	if (!is_worker_active(wid))
+		return snobj_err(EINVAL, "Worker %d does not exist", wid);
+
+	if (c->migratable)
+		return snobj_err(EINVAL, "TC '%s' is managed by work stealing",
+				tc_name);
+
+	if (!c->s || c->migrate_dst)
+		return snobj_err(EBUSY, "TC '%s' is being migrated", tc_name);
+
+	if (c->parent != &c->s->root)
+		return snobj_err(EINVAL, "Only top-level TCs can be migrated");
+
+	for (src_wid = 0; src_wid < MAX_WORKERS; src_wid++)
+		if (is_worker_active(src_wid) && workers[src_wid]->s == c->s)
+			break;
+
+	assert(src_wid < MAX_WORKERS);
+
+	dst = workers[wid]->s;
+	if (c->s == dst)
+		return NULL;
+
+	/* nobody is scheduling c. just move it */
+	if (!is_worker_running(src_wid) && !is_worker_running(wid)) {
+		sched_remove_tc(c);
+		c->migrate_dst = NULL;
+		sched_add_tc(dst, c);
+		return NULL;
+	}
+
+	if (!is_worker_running(src_wid) || !is_worker_running(wid))
+		return snobj_err(EBUSY, "Worker %d and %d must be both running "
+				"or both paused", src_wid, wid);
+
+	ret = sched_migrate_tc(c, dst);
+	if (ret < 0)
+		return snobj_errno(-ret);
+
+	/* wait for the handoff, which takes 256 rounds of each worker */
+	deadline = get_epoch_time() + 1.0;
+
+	while (*(struct sched * volatile *)&c->s != dst) {
+		if (get_epoch_time() > deadline)
+			break;
+		usleep(10);
+	}
+
+	if (c->s == dst)
+		return NULL;
+
+	/* the workers keep running. withdraw the request if not taken yet */
+	if (sched_cancel_migration(c, dst) == 0)
+		return snobj_err(ETIMEDOUT, "Migration of TC '%s' timed out. "
+				"It stays on worker %d", tc_name, src_wid);
+
+	/* the source worker has detached c. it is on its way to dst */
+	if (*(struct sched * volatile *)&c->s == dst)
+		return NULL;
+
+	return snobj_err(EINPROGRESS, "Migration of TC '%s' to worker %d "
+			"is still in progress", tc_name, wid);
 }
 
 static struct snobj *handle_list_drivers(struct snobj *q)
@@ -622,6 +944,8 @@ static struct snobj *handle_destroy_module(struct snobj *q)
 
 	destroy_module(m);
 
+	compute_metadata_offsets();
+
 	return NULL;
 }
 
@@ -632,6 +956,7 @@ static struct snobj *handle_get_module_info(struct snobj *q)
 
 	struct snobj *r;
 	struct snobj *gates;
+	struct snobj *metadata;
 
 	m_name = snobj_str_get(q);
 
@@ -643,6 +968,7 @@ static struct snobj *handle_get_module_info(struct snobj *q)
 
 	r = snobj_map();
 	gates = snobj_list();
+	metadata = snobj_list();
 
 	snobj_map_set(r, "name", snobj_str(m->name));
 	snobj_map_set(r, "mclass", snobj_str(m->mclass->name));
@@ -656,22 +982,120 @@ static struct snobj *handle_get_module_info(struct snobj *q)
 	for (int i = 0; i < m->allocated_gates; i++) {
 		if (m->gates[i].m) {
 			struct snobj *gate = snobj_map();
+#if TRACK_GATES
+			struct gate_stats stats;
+
+			get_gate_stats(m, i, &stats);
+#endif
 			snobj_map_set(gate, "gate", snobj_uint(i));
 #if TRACK_GATES
 			snobj_map_set(gate, "cnt", 
-					snobj_uint(m->gates[i].cnt));
+					snobj_uint(stats.cnt));
 			snobj_map_set(gate, "pkts", 
-					snobj_uint(m->gates[i].pkts));
+					snobj_uint(stats.pkts));
 			snobj_map_set(gate, "timestamp", 
 					snobj_double(get_epoch_time()));
 #endif
 			snobj_map_set(gate, "name", snobj_str(m->gates[i].m->name));
+			snobj_map_set(gate, "igate", 
+					snobj_uint(m->gates[i].igate));
 			snobj_list_add(gates, gate);
 		}
 	}
 
 	snobj_map_set(r, "gates", gates);
 
+	for (int i = 0; i < m->num_attrs; i++) {
+		static const char *modes[] = {"read", "write", "update"};
+		struct snobj *attr = snobj_map();
+
+		snobj_map_set(attr, "name", snobj_str(m->attrs[i].name));
+		snobj_map_set(attr, "size", snobj_int(m->attrs[i].size));
+		snobj_map_set(attr, "mode", snobj_str(modes[m->attrs[i].mode]));
+		snobj_map_set(attr, "offset", snobj_int(m->attr_offsets[i]));
+
+		snobj_list_add(metadata, attr);
+	}
+
+	snobj_map_set(r, "metadata", metadata);
+
+	return r;
+}
+
+static struct snobj *profile_to_snobj(const struct profile_stats *prof)
+{
+	struct snobj *r = snobj_map();
+
+	snobj_map_set(r, "batches", snobj_uint(prof->batches));
+	snobj_map_set(r, "packets", snobj_uint(prof->pkts));
+	snobj_map_set(r, "cycles", snobj_uint(prof->cycles));
+
+	return r;
+}
+
+/* Argument: 'one_in' (0 to disable) */
+static struct snobj *handle_enable_profile(struct snobj *q)
+{
+	uint64_t one_in;
+	int ret;
+
+	one_in = snobj_eval_uint(q, "one_in");
+	if (one_in > UINT32_MAX)
+		return snobj_err(EINVAL, "'one_in' is too large");
+
+	ret = profile_enable(one_in);
+	if (ret < 0)
+		return snobj_errno(-ret);
+
+	return NULL;
+}
+
+/* For each module, returns the sampled cycles spent in itself,
+ * and in the downstream of each output gate */
+static struct snobj *handle_get_profile(struct snobj *q)
+{
+	struct ns_iter iter;
+	struct module *m;
+
+	struct snobj *r;
+	struct snobj *modules;
+	uint64_t lost;
+
+	lost = profile_collect();
+
+	r = snobj_map();
+	modules = snobj_list();
+
+	ns_init_iterator(&iter, NS_TYPE_MODULE);
+
+	while ((m = (struct module *)ns_next(&iter)) != NULL) {
+		struct snobj *module = profile_to_snobj(&m->prof);
+		struct snobj *gates = snobj_list();
+
+		for (int i = 0; i < m->allocated_gates; i++) {
+			struct snobj *gate;
+
+			if (!m->gates[i].m)
+				continue;
+
+			gate = profile_to_snobj(&m->gates[i].prof);
+			snobj_map_set(gate, "gate", snobj_uint(i));
+			snobj_map_set(gate, "name", 
+					snobj_str(m->gates[i].m->name));
+			snobj_list_add(gates, gate);
+		}
+
+		snobj_map_set(module, "name", snobj_str(m->name));
+		snobj_map_set(module, "gates", gates);
+		snobj_list_add(modules, module);
+	}
+
+	ns_release_iterator(&iter);
+
+	snobj_map_set(r, "one_in", snobj_uint(profile_one_in));
+	snobj_map_set(r, "lost", snobj_uint(lost));
+	snobj_map_set(r, "modules", modules);
+
 	return r;
 }
 
@@ -679,7 +1103,8 @@ static struct snobj *handle_connect_modules(struct snobj *q)
 {
 	const char *m1_name;
 	const char *m2_name;
-	gate_t gate;
+	gate_t ogate;
+	gate_t igate;
 
 	struct module *m1;
 	struct module *m2;
@@ -688,7 +1113,8 @@ static struct snobj *handle_connect_modules(struct snobj *q)
 
 	m1_name = snobj_eval_str(q, "m1");
 	m2_name = snobj_eval_str(q, "m2");
-	gate = snobj_eval_uint(q, "gate");
+	ogate = snobj_eval_uint(q, "gate");
+	igate = snobj_eval_uint(q, "igate");
 
 	if (!m1_name || !m2_name)
 		return snobj_err(EINVAL, "Missing 'm1' or 'm2' field");
@@ -699,10 +1125,12 @@ static struct snobj *handle_connect_modules(struct snobj *q)
 	if ((m2 = find_module(m2_name)) == NULL)
 		return snobj_err(ENOENT, "No module '%s' found", m2_name);
 
-	ret = connect_modules(m1, gate, m2);
+	ret = connect_modules(m1, ogate, m2, igate);
 	if (ret < 0)
-		return snobj_err(-ret, "Connection '%s'[%d]->'%s' failed", 
-			m1_name, gate, m2_name);
+		return snobj_err(-ret, "Connection '%s'[%d]->[%d]'%s' failed", 
+			m1_name, ogate, igate, m2_name);
+
+	compute_metadata_offsets();
 
 	return NULL;
 }
@@ -730,6 +1158,8 @@ static struct snobj *handle_disconnect_modules(struct snobj *q)
 		return snobj_err(-ret, "Disconnection '%s'[%d] failed", 
 			m_name, gate);
 
+	compute_metadata_offsets();
+
 	return NULL;
 }
 
@@ -880,11 +1310,13 @@ static struct handler_map sn_handlers[] = {
 	{ "list_workers",	0, handle_list_workers },
 	{ "add_worker",		0, handle_add_worker },
 	{ "delete_worker",	1, handle_not_implemented },
+	{ "set_worker_idle",	0, handle_set_worker_idle },
 
 	{ "reset_tcs",		1, handle_reset_tcs },
 	{ "list_tcs",		0, handle_list_tcs },
 	{ "add_tc",		1, handle_add_tc },
 	{ "get_tc_stats",	0, handle_get_tc_stats },
+	{ "migrate_tc",		0, handle_migrate_tc },
 
 	{ "list_drivers",	0, handle_list_drivers },
 	{ "import_driver",	0, handle_not_implemented },	/* TODO */
@@ -908,6 +1340,9 @@ static struct handler_map sn_handlers[] = {
 
 	{ "attach_task",	1, handle_attach_task },
 
+	{ "enable_profile",	0, handle_enable_profile },
+	{ "get_profile",	0, handle_get_profile },
+
 	{ "enable_tcpdump",	1, handle_enable_tcpdump },
 	{ "disable_tcpdump",	1, handle_disable_tcpdump },
 
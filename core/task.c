@@ -125,9 +125,12 @@ void process_orphan_tasks()
 			continue;
 
 		if (get_next_wid(&wid) < 0) {
+			int ret;
+
 			wid = 0;
 			/* There is no active worker. Create one. */
-			launch_worker(wid, 0);
+			ret = launch_worker(wid, 0);
+			assert(ret == 0);
 		}
 
 		assign_default_tc(wid, t);
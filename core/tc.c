@@ -11,26 +11,80 @@
 #include "common.h"
 #include "time.h"
 #include "task.h"
+#include "profile.h"
 #include "worker.h"
 #include "log.h"
 #include "utils/random.h"
+#include "kmod/llring.h"
 
 #include "tc.h"
 
-/* this library is not thread safe */
+/* this library is not thread safe, 
+ * except for the work stealing part (see sched_balance()) */
+
+/* TCs offered to other workers, and whether each worker wants more work.
+ * Not in struct sched, since other workers may access them anytime */
+static struct wsdeque offered_tcs[MAX_WORKERS];
+static struct {
+	volatile int flag;	/* one cache line each, written by its owner */
+} __cacheline_aligned hungry[MAX_WORKERS];
+
+/* A worker is hungry if idle for at least 1/2 of the last 256 rounds */
+#define HUNGRY_IDLE_ROUNDS	128
+
+/* migrated TCs are not offered again for a while, to avoid ping-pong */
+#define MIGRATION_HOLD_US	10000
+
+#define SCHED_INBOX_SLOTS	64
+
+/* how often workers publish stats snapshots (see sched_publish_stats()) */
+#define STATS_PUBLISH_US	100000
+
+/* idle backoff: up to 2^IDLE_MAX_PAUSE_SHIFT pause instructions per round,
+ * doubled for every 2^IDLE_PAUSE_STEP_SHIFT idle rounds */
+#define IDLE_PAUSE_STEP_SHIFT	4
+#define IDLE_MAX_PAUSE_SHIFT	6
+
+/* for THROTTLE_QUEUE_WHEEL: ~1us ticks, with a window of ~4ms */
+#define WHEEL_TICK_NS		1000
+#define WHEEL_BUCKETS		4096
+
+/* inbox messages are TC pointers, tagged in the lowest bits */
+enum {
+	SCHED_MSG_RELEASE = 1,	/* detach the TC and send it to migrate_dst */
+	SCHED_MSG_ADOPT = 2,	/* attach the TC to myself */
+	SCHED_MSG_MASK = 3,
+};
+
+static inline int tc_policy(const struct tc *c)
+{
+	return c->edf.period_tsc ? PGROUP_POLICY_EDF : PGROUP_POLICY_STRIDE;
+}
+
+/* the key of c in its pgroup's heap */
+static inline int64_t pgroup_key(const struct pgroup *g, const struct tc *c)
+{
+	return (g->policy == PGROUP_POLICY_EDF) ? c->edf.deadline : c->ss.pass;
+}
 
 static void tc_add_to_parent_pgroup(struct tc *c, int share_resource)
 {
 	struct tc *parent = c->parent;
 	struct pgroup *g = NULL;
+	int policy = tc_policy(c);
 
 	struct cdlist_item *next;
 
+	/* sorted by priority, then EDF before stride */
 	cdlist_for_each_entry(g, &parent->pgroups, tc) {
-		if (c->priority > g->priority) {
+		if (c->priority > g->priority || 
+				(c->priority == g->priority && 
+				 policy == PGROUP_POLICY_EDF &&
+				 g->policy == PGROUP_POLICY_STRIDE)) 
+		{
 			next = &g->tc;
 			goto pgroup_init;
-		} else if (c->priority == g->priority)
+		} else if (c->priority == g->priority && g->policy == policy)
 			goto pgroup_add;
 	}
 
@@ -47,6 +101,7 @@ pgroup_init:
 
 	g->resource = share_resource;
 	g->priority = c->priority;
+	g->policy = policy;
 
 	/* fall through */
 
@@ -95,23 +150,38 @@ struct tc *tc_init(struct sched *s, const struct tc_params *params)
 	tc_inc_refcnt(c->parent);
 
 	c->auto_free = params->auto_free;
+	c->share_resource = params->share_resource;
+	c->migratable = params->migratable && !params->parent;
 
 	c->last_tsc = rdtsc();
 
 	for (i = 0; i < NUM_RESOURCES; i++) {
 		assert(params->limit[i] < (1UL << MAX_LIMIT_POW));
 		
-		c->tb[i].limit = (params->limit[i] << (USAGE_AMPLIFIER_POW - 4)) 
+		c->tb.limit[i] = (params->limit[i] << (USAGE_AMPLIFIER_POW - 4)) 
 				/ (tsc_hz >> 4);
 
-		if (c->tb[i].limit) {
+		if (c->tb.limit[i]) {
 			assert(params->max_burst[i] < (1UL << MAX_LIMIT_POW));
-			c->tb[i].max_burst = (params->max_burst[i] << 
+			c->tb.limit_recip[i] = UINT64_MAX / c->tb.limit[i];
+			c->tb.max_burst[i] = (params->max_burst[i] << 
 					(USAGE_AMPLIFIER_POW - 4)) / (tsc_hz >> 4);
 			c->has_limit = 1;
 		}
 
-		c->tb[i].tokens = 0;
+		c->tb.tokens[i] = 0;
+	}
+	
+	c->burst = MAX_PKT_BURST;
+
+	c->quantum_tasks = params->quantum_tasks;
+	c->quantum_tsc = params->quantum_ns * tsc_hz / 1000000000;
+	c->target_latency_tsc = params->target_latency_ns * tsc_hz / 1000000000;
+
+	if (params->period_ns) {
+		c->edf.period_tsc = RTE_MAX(params->period_ns * tsc_hz / 
+				1000000000, 1UL);
+		c->edf.deadline = c->last_tsc + c->edf.period_tsc;
 	}
 	
 	c->ss.stride = STRIDE1 / params->share;
@@ -181,7 +251,13 @@ void tc_join(struct tc *c)
 	if (!c->state.throttled) {
 		c->state.queued = 1;
 		c->ss.pass = (next ? next->ss.pass : 0) + c->ss.remain;
-		heap_push(pq, c->ss.pass, c);
+
+		/* released right away */
+		if (g->policy == PGROUP_POLICY_EDF)
+			c->edf.deadline = RTE_MAX(c->edf.deadline, 
+					rdtsc() + c->edf.period_tsc);
+
+		heap_push(pq, pgroup_key(g, c), c);
 		tc_inc_refcnt(c);
 	}
 }
@@ -200,7 +276,7 @@ void tc_leave(struct tc *c)
 	c->ss.remain = c->ss.pass - next->ss.pass;
 }
 
-struct sched *sched_init()
+struct sched *sched_init(int throttle_queue)
 {
 	struct sched *s;
 
@@ -212,10 +288,31 @@ struct sched *sched_init()
 	cdlist_head_init(&s->root.tasks);	/* this will be always empty */
 	cdlist_head_init(&s->root.pgroups);
 
-	heap_init(&s->pq);
+	s->throttle_queue = throttle_queue;
+
+	if (throttle_queue == THROTTLE_QUEUE_WHEEL) {
+		uint64_t tick_tsc = tsc_hz * WHEEL_TICK_NS / 1000000000;
+		int shift = 0;
+
+		while ((2UL << shift) <= tick_tsc)
+			shift++;
+
+		if (tw_init(&s->wheel, shift, WHEEL_BUCKETS, rdtsc()))
+			oom_crash();
+	} else
+		heap_init(&s->pq);
 
 	cdlist_head_init(&s->tcs_all);
 
+	s->inbox = rte_zmalloc("sched_inbox", 
+			llring_bytes_with_slots(SCHED_INBOX_SLOTS), 0);
+	if (!s->inbox)
+		oom_crash();
+
+	llring_init(s->inbox, SCHED_INBOX_SLOTS, 0, 1);
+
+	s->wid = ctx.wid;
+
 	return s;
 }
 
@@ -238,15 +335,304 @@ void sched_free(struct sched *s)
 		}
 	}
 
-	heap_close(&s->pq);
+	if (s->throttle_queue == THROTTLE_QUEUE_WHEEL)
+		tw_close(&s->wheel);
+	else
+		heap_close(&s->pq);
+
+	rte_free(s->inbox);
 
 	/* the actual memory block of s will be freed by the root TC
 	 * since it shares the address with this scheduler */
 	tc_dec_refcnt(&s->root);
 }
 
+static int tc_is_descendant(const struct tc *c, const struct tc *ancestor)
+{
+	for (; c; c = c->parent)
+		if (c == ancestor)
+			return 1;
+
+	return 0;
+}
+
+/* c will not be scheduled until until_tsc. 
+ * The caller should hold a reference for the throttled queue */
+static inline void throttled_push(struct sched *s, struct tc *c,
+		uint64_t until_tsc)
+{
+	if (s->throttle_queue == THROTTLE_QUEUE_WHEEL)
+		tw_add(&s->wheel, &c->throttle_timer, until_tsc);
+	else
+		heap_push(&s->pq, until_tsc, c);
+}
+
+/* returns when c would have been resumed */
+static uint64_t throttled_remove(struct sched *s, struct tc *c)
+{
+	int64_t until;
+	int ret;
+
+	if (s->throttle_queue == THROTTLE_QUEUE_WHEEL) {
+		tw_remove(&s->wheel, &c->throttle_timer);
+		return c->throttle_timer.expiry;
+	}
+
+	ret = heap_remove(&s->pq, c, &until);
+	assert(ret == 0);
+
+	return until;
+}
+
+static void tc_detach_class(struct sched *s, struct tc *c)
+{
+	/* keep the reference of the throttled queue until it's re-added */
+	if (c->state.throttled)
+		c->throttled_until = throttled_remove(s, c);
+
+	cdlist_del(&c->sched_all);
+	s->num_classes--;
+	c->s = NULL;
+}
+
+static void tc_attach_class(struct sched *s, struct tc *c)
+{
+	if (c->state.throttled)
+		throttled_push(s, c, c->throttled_until);
+
+	cdlist_add_tail(&s->tcs_all, &c->sched_all);
+	s->num_classes++;
+	c->s = s;
+}
+
+void sched_remove_tc(struct tc *c)
+{
+	struct sched *s = c->s;
+	struct pgroup *g = c->ss.my_pgroup;
+	struct tc *d;
+	struct tc *next;
+
+	assert(c->parent == &s->root);
+	assert(!s->current);
+
+	tc_inc_refcnt(c);	/* held while detached */
+
+	if (c->state.queued) {
+		struct tc *head;
+		int ret;
+
+		ret = heap_remove(&g->pq, c, NULL);
+		assert(ret == 0);
+
+		c->state.queued = 0;
+		tc_dec_refcnt(c);
+
+		/* as in tc_leave(), but c stays runnable */
+		head = heap_peek(&g->pq);
+		c->ss.remain = c->ss.pass - (head ? head->ss.pass : 0);
+	}
+
+	g->num_children--;
+	if (g->num_children == 0) {
+		cdlist_del(&g->tc);
+		heap_close(&g->pq);
+		rte_free(g);
+	}
+	c->ss.my_pgroup = NULL;
+
+	tc_dec_refcnt(c->parent);
+	c->parent = NULL;
+
+	tc_detach_class(s, c);
+	cdlist_item_init(&c->sched_all);
+
+	cdlist_for_each_entry_safe(d, next, &s->tcs_all, sched_all) {
+		if (!tc_is_descendant(d, c))
+			continue;
+
+		tc_detach_class(s, d);
+		cdlist_add_before(&c->sched_all, &d->sched_all);
+	}
+}
+
+void sched_add_tc(struct sched *s, struct tc *c)
+{
+	assert(!c->s);
+	assert(!s->current);
+
+	while (cdlist_is_hooked(&c->sched_all)) {
+		struct tc *d = container_of(c->sched_all.next, 
+				struct tc, sched_all);
+
+		cdlist_del(&d->sched_all);
+		tc_attach_class(s, d);
+	}
+
+	tc_attach_class(s, c);
+
+	c->parent = &s->root;
+	tc_inc_refcnt(c->parent);
+	tc_add_to_parent_pgroup(c, c->share_resource);
+
+	if (c->state.runnable) {
+		c->state.runnable = 0;
+		tc_join(c);
+	}
+
+	tc_dec_refcnt(c);
+}
+
+static inline void *sched_msg(struct tc *c, int type)
+{
+	return (void *)((uintptr_t)c | type);
+}
+
+int sched_migrate_tc(struct tc *c, struct sched *dst)
+{
+	if (c->migratable || c->parent != &c->s->root)
+		return -EINVAL;
+
+	if (c->s == dst)
+		return 0;
+
+	c->migrate_dst = dst;
+
+	if (llring_mp_enqueue(c->s->inbox, sched_msg(c, SCHED_MSG_RELEASE)) 
+			== -LLRING_ERR_NOBUF)
+	{
+		c->migrate_dst = NULL;
+		return -ENOBUFS;
+	}
+
+	/* the source worker may be sleeping (see sched_idle()) */
+	wakeup_worker(c->s->wid);
+
+	return 0;
+}
+
+int sched_cancel_migration(struct tc *c, struct sched *dst)
+{
+	/* the RELEASE message will be ignored as stale */
+	if (__sync_bool_compare_and_swap(&c->migrate_dst, dst, NULL))
+		return 0;
+
+	return -EINPROGRESS;
+}
+
+/* Processes inbox messages. Called by the worker outside of tasks */
+static void sched_process_msgs(struct sched *s, uint64_t tsc)
+{
+	void *msg;
+
+	while (llring_sc_dequeue(s->inbox, &msg) == 0) {
+		struct tc *c = (struct tc *)((uintptr_t)msg & ~SCHED_MSG_MASK);
+		struct sched *dst;
+
+		switch ((uintptr_t)msg & SCHED_MSG_MASK) {
+		case SCHED_MSG_RELEASE:
+			dst = c->migrate_dst;
+
+			/* stale or cancelled request? */
+			if (!dst || c->s != s || dst == s) {
+				__sync_bool_compare_and_swap(&c->migrate_dst,
+						dst, NULL);
+				break;
+			}
+
+			/* claim it, racing with sched_cancel_migration() */
+			if (!__sync_bool_compare_and_swap(&c->migrate_dst,
+						dst, NULL))
+				break;
+
+			sched_remove_tc(c);
+
+			if (llring_mp_enqueue(dst->inbox, 
+					sched_msg(c, SCHED_MSG_ADOPT))
+					== -LLRING_ERR_NOBUF)
+			{
+				log_err("TC %s: migration failed\n", c->name);
+				sched_add_tc(s, c);
+				break;
+			}
+
+			wakeup_worker(dst->wid);
+			break;
+
+		case SCHED_MSG_ADOPT:
+			c->migrated_tsc = tsc;
+			c->migrate_dst = NULL;
+			sched_add_tc(s, c);
+			break;
+
+		default:
+			assert(0);
+		}
+	}
+}
+
+void sched_settle_all(void)
+{
+	int progress;
+
+	/* an inbox may be refilled by another one (RELEASE -> ADOPT) */
+	do {
+		progress = 0;
+
+		for (int wid = 0; wid < MAX_WORKERS; wid++) {
+			struct sched *s;
+			struct tc *c;
+
+			if (!is_worker_active(wid) || is_worker_running(wid))
+				continue;
+
+			s = workers[wid]->s;
+
+			while ((c = wsdeque_pop(&offered_tcs[wid])) != NULL) {
+				sched_add_tc(s, c);
+				progress = 1;
+			}
+
+			if (!llring_empty(s->inbox)) {
+				sched_process_msgs(s, rdtsc());
+				progress = 1;
+			}
+		}
+	} while (progress);
+}
+
+static inline void tc_unthrottle(struct tc *c, uint64_t event_tsc)
+{
+	c->state.throttled = 0;
+	
+	if (c->state.runnable) {
+		/* No refcnt is adjusted, since we transfer the reference
+		 * of the throttled queue to my_pgroup->pq */ 
+		struct pgroup *g = c->ss.my_pgroup;
+
+		c->state.queued = 1;
+		c->last_tsc = event_tsc;
+		heap_push(&g->pq, g->policy == PGROUP_POLICY_EDF ? 
+				c->edf.deadline : 0, c);
+	} else
+		tc_dec_refcnt(c);
+}
+
 static void resume_throttled(struct sched *s, uint64_t tsc)
 {
+	if (s->throttle_queue == THROTTLE_QUEUE_WHEEL) {
+		struct tw_timer *t;
+
+		while ((t = tw_pop_expired(&s->wheel, tsc)) != NULL) {
+			struct tc *c = container_of(t, struct tc, 
+					throttle_timer);
+
+			/* may expire up to a tick early */
+			tc_unthrottle(c, RTE_MIN(t->expiry, tsc));
+		}
+
+		return;
+	}
+
 	while (s->pq.num_nodes > 0) {
 		struct tc *c;
 		int64_t event_tsc;
@@ -258,16 +644,7 @@ static void resume_throttled(struct sched *s, uint64_t tsc)
 
 		heap_pop(&s->pq);
 
-		c->state.throttled = 0;
-		
-		if (c->state.runnable) {
-			/* No refcnt is adjusted, since we transfer 
-			 * s->pq's reference to my_pgroup->pq */ 
-			c->state.queued = 1;
-			c->last_tsc = event_tsc;
-			heap_push(&c->ss.my_pgroup->pq, 0, c);
-		} else
-			tc_dec_refcnt(c);
+		tc_unthrottle(c, event_tsc);
 	}
 }
 
@@ -349,14 +726,60 @@ static inline void accumulate(resource_arr_t acc, resource_arr_t x)
 #endif
 }
 
+/* c will not be scheduled until until_tsc */
+static inline void tc_defer(struct sched *s, struct tc *c, 
+		uint64_t until_tsc)
+{
+	c->state.throttled = 1;
+
+	throttled_push(s, c, until_tsc);
+	tc_inc_refcnt(c);
+}
+
+/* same as above, but due to its limit */
+static inline void tc_throttle(struct sched *s, struct tc *c, 
+		uint64_t until_tsc)
+{
+	c->stats.cnt_throttled++;
+	tc_defer(s, c, until_tsc);
+}
+
+/* For PGROUP_POLICY_EDF: c has finished a job. Sets its next release
+ * (one period after the last one) and deadline. Returns 1 if c is deferred
+ * until the release, or has already been throttled. */
+static int tc_edf_done(struct sched *s, struct tc *c, int throttled,
+		uint64_t tsc)
+{
+	uint64_t release = c->edf.deadline;
+
+	/* do not try to catch up, if late */
+	if (unlikely(tsc > release)) {
+		c->edf.missed++;
+		release = tsc;
+	}
+
+	c->edf.deadline = release + c->edf.period_tsc;
+
+	if (throttled || release <= tsc)
+		return throttled;
+
+	tc_defer(s, c, release);
+	return 1;
+}
+
+/* high 64 bits of a * b */
+static inline uint64_t mul_hi64(uint64_t a, uint64_t b)
+{
+	return (uint64_t)(((unsigned __int128)a * b) >> 64);
+}
+
 /* returns 1 if it has been throttled */
 static int tc_account(struct sched *s, struct tc *c, 
 		resource_arr_t usage, uint64_t tsc)
 {
 	uint64_t elapsed_cycles;
 	uint64_t max_wait_tsc;
-
-	int throttled;
+	uint64_t throttled;
 
 	int i;
 
@@ -373,42 +796,36 @@ static int tc_account(struct sched *s, struct tc *c,
 	max_wait_tsc = 0;
 	throttled = 0;
 
+	/* No branches (other than cmov) and no divisions. Unlimited resources
+	 * have all-zero token buckets, so they never throttle the class */
 	for (i = 0; i < NUM_RESOURCES; i++) {
-		uint64_t consumed;
-		uint64_t tokens;
-
-		const uint64_t limit = c->tb[i].limit;
-
-		if (!limit)
-			continue;
+		const uint64_t limit = c->tb.limit[i];
 
-		consumed = usage[i] << USAGE_AMPLIFIER_POW;
-		tokens = c->tb[i].tokens + limit * elapsed_cycles;
+		uint64_t consumed = usage[i] << USAGE_AMPLIFIER_POW;
+		uint64_t tokens = c->tb.tokens[i] + limit * elapsed_cycles;
+		uint64_t deficit;
+		uint64_t wait_tsc;
 
-		if (tokens < consumed) {
-			uint64_t wait_tsc;
+		deficit = (tokens < consumed) ? consumed - tokens : 0;
+		deficit &= -(uint64_t)(limit != 0);
 
-			wait_tsc = (consumed - tokens) / limit;
+		/* deficit / limit, rounded up (off by one at most) */
+		wait_tsc = mul_hi64(deficit, c->tb.limit_recip[i]) + 
+				(deficit != 0);
 
-			throttled = 1;
+		max_wait_tsc = RTE_MAX(max_wait_tsc, wait_tsc);
+		throttled |= deficit;
 
-			if (wait_tsc > max_wait_tsc)
-				max_wait_tsc = wait_tsc;
-		} else
-			c->tb[i].tokens = RTE_MIN(tokens - consumed, 
-					c->tb[i].max_burst);
+		/* garbage if deficit != 0, but then it is reset below */
+		c->tb.tokens[i] = RTE_MIN(tokens - consumed, 
+				c->tb.max_burst[i]);
 	}
 
 	if (throttled) {
 		for (i = 0; i < NUM_RESOURCES; i++)
-			c->tb[i].tokens = 0;
-
-		c->state.throttled = 1;
-		c->stats.cnt_throttled++;
-
-		heap_push(&s->pq, tsc + max_wait_tsc, c);
-		tc_inc_refcnt(c);
+			c->tb.tokens[i] = 0;
 
+		tc_throttle(s, c, tsc + max_wait_tsc);
 		return 1;
 	}
 		
@@ -419,6 +836,9 @@ static int tc_account(struct sched *s, struct tc *c,
 static void sched_done(struct sched *s, struct tc *c, 
 		resource_arr_t usage, int reschedule, uint64_t tsc)
 {
+	/* only applies to the leaf */
+	uint64_t backpressure_tsc = s->backpressure_tsc;
+
 	accumulate(s->stats.usage, usage);
 
 	assert(s->current);
@@ -437,14 +857,27 @@ static void sched_done(struct sched *s, struct tc *c,
 		int throttled;
 
 		assert(c->state.queued);
-		c->ss.pass += c->ss.stride * consumed / QUANTUM;
+		c->ss.pass += (c->ss.stride * consumed) >> QUANTUM_POW;
 
 		throttled = tc_account(s, c, usage, tsc);
+
+		if (g->policy == PGROUP_POLICY_EDF)
+			throttled = tc_edf_done(s, c, throttled, tsc);
+
+		if (unlikely(backpressure_tsc)) {
+			if (!throttled) {
+				tc_throttle(s, c, tsc + backpressure_tsc);
+				throttled = 1;
+			}
+
+			backpressure_tsc = s->backpressure_tsc = 0;
+		}
+
 		if (throttled) 
 			reschedule = 0;
 
 		if (reschedule) {
-			heap_replace(pq, c->ss.pass, c);
+			heap_replace(pq, pgroup_key(g, c), c);
 		} else {
 			struct tc *next;
 
@@ -626,17 +1059,98 @@ static void print_stats(struct sched *s, struct sched_stats *last_stats)
 	log_info("%s", buf);
 }
 
-static inline struct task_result tc_scheduled(struct tc *c)
+/* Halves the burst size if a burst takes longer than the target latency on
+ * average, and doubles it if the task used it up (i.e., the queue has more
+ * packets) and a doubled burst would still meet the target. */
+static inline void tc_adapt_burst(struct tc *c, uint64_t packets, 
+		uint64_t cycles)
+{
+	uint64_t burst = c->burst;
+
+	if (packets == 0)
+		return;
+
+	c->avg_cycles += ((int64_t)cycles - (int64_t)c->avg_cycles) >> 3;
+	c->avg_packets += ((int64_t)(packets << 8) - 
+			(int64_t)c->avg_packets) >> 3;
+
+	/* burst * (avg_cycles / avg_packets) vs. target, without division */
+	if (burst * (c->avg_cycles << 8) > 
+			c->target_latency_tsc * c->avg_packets)
+	{
+		c->burst = RTE_MAX(burst / 2, 1);
+	} else if (packets >= burst && burst * 2 * (c->avg_cycles << 8) <= 
+			c->target_latency_tsc * c->avg_packets)
+	{
+		c->burst = RTE_MIN(burst * 2, MAX_TC_BURST);
+	}
+}
+
+static inline struct task_result tc_run_task(struct task *t)
+{
+	if (unlikely(profile_sample()))
+		return profile_task(t);
+
+	return task_scheduled(t);
+}
+
+/* Runs the tasks of c for its quantum (see tc_params), in round robin.
+ * Stops early if none of the tasks has returned packets in a full pass.
+ * *invocations is set to the number of task invocations */
+static struct task_result tc_run_quantum(struct tc *c, uint32_t *invocations)
+{
+	struct task_result ret = {.packets = 0, .bits = 0};
+	struct task *t;
+
+	const int num_tasks = c->num_tasks;
+	uint64_t start_tsc = ctx.current_tsc;
+	uint32_t n = 0;
+	int idle = 0;
+
+	while (idle < num_tasks) {
+		struct task_result r;
+
+		t = container_of(cdlist_rotate_left(&c->tasks), struct task, tc);
+
+		r = tc_run_task(t);
+		ret.packets += r.packets;
+		ret.bits += r.bits;
+
+		idle = r.packets ? 0 : idle + 1;
+
+		if (++n >= c->quantum_tasks)
+			break;
+
+		if (c->quantum_tsc) {
+			ctx.current_tsc = rdtsc();
+			if (ctx.current_tsc - start_tsc >= c->quantum_tsc)
+				break;
+		}
+	}
+
+	*invocations = n;
+
+	return ret;
+}
+
+static inline struct task_result tc_scheduled(struct tc *c, 
+		uint32_t *invocations)
 {
 	struct task_result ret;
 	struct task *t;
 
 	int num_tasks = c->num_tasks;
 
+	if (c->quantum_tasks)
+		return tc_run_quantum(c, invocations);
+
+	/* the packets returned are from a single task, if any */
+	*invocations = num_tasks ? 1 : 0;
+
 	while (num_tasks--) {
 		t = container_of(cdlist_rotate_left(&c->tasks), struct task, tc);
 
-		ret = task_scheduled(t);
+		ret = tc_run_task(t);
 		if (ret.packets)
 			return ret;
 	}
@@ -644,9 +1158,219 @@ static inline struct task_result tc_scheduled(struct tc *c)
 	return (struct task_result){.packets = 0, .bits = 0};
 }
 
+/* Takes back the TCs that have been offered but not stolen */
+static void sched_reclaim(struct sched *s)
+{
+	struct wsdeque *d = &offered_tcs[ctx.wid];
+	struct tc *c;
+
+	if (wsdeque_is_empty(d))
+		return;
+
+	while ((c = wsdeque_pop(d)) != NULL)
+		sched_add_tc(s, c);
+}
+
+static int is_anyone_hungry(void)
+{
+	for (int wid = 0; wid < MAX_WORKERS; wid++)
+		if (wid != ctx.wid && hungry[wid].flag)
+			return 1;
+
+	return 0;
+}
+
+static void steal_tc(struct sched *s, uint64_t tsc)
+{
+	for (int i = 1; i < MAX_WORKERS; i++) {
+		int wid = (ctx.wid + i) % MAX_WORKERS;
+		struct tc *c;
+
+		c = wsdeque_steal(&offered_tcs[wid]);
+		if (c) {
+			c->migrated_tsc = tsc;
+			sched_add_tc(s, c);
+			s->cnt_stolen++;
+			return;
+		}
+	}
+}
+
+/* Offers a runnable, migratable TC, as long as at least one other 
+ * runnable TC remains on this worker */
+static void offer_tc(struct sched *s, uint64_t tsc)
+{
+	const uint64_t hold_tsc = MIGRATION_HOLD_US * tsc_hz / 1000000;
+
+	struct tc *candidate = NULL;
+	struct tc *c;
+
+	int num_runnable = 0;
+
+	cdlist_for_each_entry(c, &s->tcs_all, sched_all) {
+		if (c->parent != &s->root || !c->state.runnable)
+			continue;
+
+		num_runnable++;
+
+		if (c->migratable && tsc - c->migrated_tsc >= hold_tsc)
+			candidate = c;
+	}
+
+	if (!candidate || num_runnable < 2)
+		return;
+
+	sched_remove_tc(candidate);
+
+	if (wsdeque_push(&offered_tcs[ctx.wid], candidate) < 0) {
+		sched_add_tc(s, candidate);
+		return;
+	}
+
+	/* it doesn't matter if it is reclaimed later */
+	s->cnt_given++;
+}
+
+/* Work stealing. Called every 256 rounds, with the number of idle rounds.
+ * A TC offered by a busy worker is put into its deque, where it is not 
+ * scheduled by anyone until either a hungry worker steals it, or the owner
+ * takes it back in the next period. Either way, the TC is on exactly one 
+ * scheduler at a time. */
+static void sched_balance(struct sched *s, uint64_t idle_rounds, uint64_t tsc)
+{
+	sched_reclaim(s);
+
+	hungry[ctx.wid].flag = (idle_rounds >= HUNGRY_IDLE_ROUNDS);
+
+	if (hungry[ctx.wid].flag)
+		steal_tc(s, tsc);
+	else if (idle_rounds == 0 && is_anyone_hungry())
+		offer_tc(s, tsc);
+}
+
+/* rates[i] = per-second increase of n counters, from last to cur */
+static void calc_rates(uint64_t *rates, const uint64_t *cur, 
+		const uint64_t *last, int n, uint64_t elapsed_tsc)
+{
+	double scale = elapsed_tsc ? (double)tsc_hz / elapsed_tsc : 0.0;
+
+	for (int i = 0; i < n; i++)
+		rates[i] = (cur[i] - last[i]) * scale;
+}
+
+/* Takes snapshots of the scheduler and all its TCs. 
+ * Only the owner worker writes them, with no lock other than seqlocks */
+static void sched_publish_stats(struct sched *s, uint64_t now)
+{
+	const int num_tc_counters = sizeof(struct tc_stats) / sizeof(uint64_t);
+	const int num_sched_counters = 
+			sizeof(struct sched_stats) / sizeof(uint64_t);
+
+	struct tc *c;
+
+	cdlist_for_each_entry(c, &s->tcs_all, sched_all) {
+		seqlock_write_begin(&c->snap_lock);
+
+		calc_rates((uint64_t *)&c->snap.rates, 
+				(const uint64_t *)&c->stats,
+				(const uint64_t *)&c->snap.stats,
+				num_tc_counters, 
+				c->snap.tsc ? now - c->snap.tsc : 0);
+		c->snap.stats = c->stats;
+		c->snap.tsc = now;
+
+		seqlock_write_end(&c->snap_lock);
+	}
+
+	seqlock_write_begin(&s->snap_lock);
+
+	calc_rates((uint64_t *)&s->snap.rates, 
+			(const uint64_t *)&s->stats,
+			(const uint64_t *)&s->snap.stats,
+			num_sched_counters, 
+			s->snap.tsc ? now - s->snap.tsc : 0);
+	s->snap.stats = s->stats;
+	s->snap.tsc = now;
+
+	seqlock_write_end(&s->snap_lock);
+}
+
+void tc_get_snapshot(const struct tc *c, struct tc_snapshot *snap)
+{
+	uint32_t seq;
+
+	do {
+		seq = seqlock_read_begin(&c->snap_lock);
+		*snap = c->snap;
+	} while (seqlock_read_retry(&c->snap_lock, seq));
+}
+
+void sched_get_snapshot(const struct sched *s, struct sched_snapshot *snap)
+{
+	uint32_t seq;
+
+	do {
+		seq = seqlock_read_begin(&s->snap_lock);
+		*snap = s->snap;
+	} while (seqlock_read_retry(&s->snap_lock, seq));
+}
+
+/* Returns the TSC when the next throttled TC resumes, or UINT64_MAX if none */
+static uint64_t next_throttle_tsc(struct sched *s)
+{
+	if (s->throttle_queue == THROTTLE_QUEUE_WHEEL)
+		return tw_next_expiry(&s->wheel);
+
+	if (s->pq.num_nodes == 0)
+		return UINT64_MAX;
+
+	return s->pq.arr_v[1];
+}
+
+/* Called after idle_streak consecutive rounds without any packet.
+ * Returns 1 if the worker has slept */
+static int sched_idle(struct sched *s, uint64_t idle_streak, uint64_t now)
+{
+	int mode = ctx.idle_mode;
+	uint64_t until;
+	uint64_t timeout_ns;
+
+	if (mode == IDLE_MODE_SPIN)
+		return 0;
+
+	if (mode == IDLE_MODE_PAUSE || idle_streak < ctx.idle_sleep_rounds ||
+			is_pause_requested() || !llring_empty(s->inbox)) 
+	{
+		int shift = RTE_MIN(idle_streak >> IDLE_PAUSE_STEP_SHIFT,
+				IDLE_MAX_PAUSE_SHIFT);
+
+		for (int i = 0; i < (1 << shift); i++)
+			_mm_pause();
+
+		return 0;
+	}
+
+	/* do not oversleep throttled TCs */
+	until = RTE_MIN(next_throttle_tsc(s), 
+			now + ctx.idle_max_sleep_us * tsc_hz / 1000000);
+	if (until <= now)
+		return 0;
+
+	timeout_ns = (until - now) * 1000000000 / tsc_hz;
+	if (timeout_ns == 0)
+		return 0;
+
+	worker_sleep(timeout_ns);
+
+	return 1;
+}
+
 void sched_loop(struct sched *s)
 {
 	struct sched_stats last_stats = s->stats;
+	uint64_t last_cnt_idle = s->stats.cnt_idle;
+	uint64_t idle_streak = 0;
+	uint64_t publish_tsc = STATS_PUBLISH_US * tsc_hz / 1000000;
 	uint64_t last_print_tsc;
 	uint64_t checkpoint;
 	uint64_t now;
@@ -658,11 +1382,20 @@ void sched_loop(struct sched *s)
 		struct tc *c;
 		struct task_result ret;
 		resource_arr_t usage;
+		uint32_t invocations;
 
 		/* periodic check for every 2^8 rounds,
 		 * to mitigate expensive operations */
 		if ((round & 0xff) == 0) {
 			if (unlikely(is_pause_requested())) {
+				/* no TC should be in transit while paused */
+				sched_reclaim(s);
+				sched_process_msgs(s, now);
+				hungry[ctx.wid].flag = 0;
+
+				/* stats remain valid while paused */
+				sched_publish_stats(s, now);
+
 				if (unlikely(block_worker()))
 					break;
 				last_stats = s->stats;
@@ -673,6 +1406,15 @@ void sched_loop(struct sched *s)
 				last_stats = s->stats;
 				last_print_tsc = checkpoint = now = rdtsc();
 			}
+
+			if (unlikely(!llring_empty(s->inbox)))
+				sched_process_msgs(s, now);
+
+			if (now - s->snap.tsc >= publish_tsc)
+				sched_publish_stats(s, now);
+
+			sched_balance(s, s->stats.cnt_idle - last_cnt_idle, now);
+			last_cnt_idle = s->stats.cnt_idle;
 		}
 
 		/* Schedule (S) */
@@ -681,7 +1423,7 @@ void sched_loop(struct sched *s)
 		if (c) {
 			/* Running (R) */
 			ctx.current_tsc = now;	/* tasks see updated tsc */
-			ret = tc_scheduled(c);
+			ret = tc_scheduled(c, &invocations);
 
 			now = rdtsc();
 
@@ -691,10 +1433,40 @@ void sched_loop(struct sched *s)
 			usage[RESOURCE_PACKET] = ret.packets;
 			usage[RESOURCE_BIT] = ret.bits;
 
+			/* per invocation, if run for a quantum.
+			 * none if the TC has no task (e.g., moved away) */
+			if (c->target_latency_tsc && invocations) {
+				if (invocations == 1)
+					tc_adapt_burst(c, ret.packets, 
+						usage[RESOURCE_CYCLE]);
+				else
+					tc_adapt_burst(c, 
+						ret.packets / invocations, 
+						usage[RESOURCE_CYCLE] / 
+							invocations);
+			}
+
 			sched_done(s, c, usage, 1, now);
+
+			if (ret.packets)
+				idle_streak = 0;
+			else
+				idle_streak++;
 		} else {
 			now = rdtsc();
+			idle_streak++;
+		}
+
+		if (unlikely(idle_streak > 0 && ctx.idle_mode != IDLE_MODE_SPIN))
+		{
+			/* after sleeping, run the periodic check right away */
+			if (sched_idle(s, idle_streak, now))
+				round |= 0xff;
+
+			now = rdtsc();
+		}
 
+		if (!c) {
 			s->stats.cnt_idle++;
 			s->stats.cycles_idle += (now - checkpoint);
 		}
@@ -711,7 +1483,7 @@ static uint64_t get_usec(void)
 	return tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
-void sched_test_alloc()
+static void sched_test_alloc(void)
 {
 	const int num_classes = 100000;
 
@@ -722,7 +1494,7 @@ void sched_test_alloc()
 
 	int i;
 
-	s = sched_init();
+	s = sched_init(THROTTLE_QUEUE_HEAP);
 
 	/* generate a random tree */
 	for (i = 0; i < num_classes; i++) {
@@ -737,8 +1509,10 @@ void sched_test_alloc()
 
 		/* params.share_resource = rand_fast(&seed) % 2, should fail */
 		params.share_resource = params.priority % NUM_RESOURCES,
+		snprintf(params.name, sizeof(params.name), "test_alloc%d", i);
 		
 		classes[i] = tc_init(s, &params);
+		assert(!is_err(classes[i]));
 	}
 
 	assert(s->num_classes == num_classes);
@@ -768,20 +1542,25 @@ void sched_test_alloc()
 	log_debug("SCHED: test passed\n");
 }
 
-void sched_test_perf()
+/* Measures the cost of a scheduling round (sched_next() + sched_done()).
+ * 1/3 and 1/2 of the classes are rate limited, so with many classes the
+ * throttled queue dominates. Runs in simulated time (1us per round) */
+static void sched_test_perf(int throttle_queue, int num_classes)
 {
-#if 1
-	const int num_classes = 50;	/* CPU bound */
-#else
-	const int num_classes = 1000;	/* cache bound */
-#endif
+	const int num_rounds = 10000000;
+	const uint64_t round_cycles = tsc_hz / 1000000;
 
 	struct sched *s;
 	struct tc *classes[num_classes];
 
+	uint64_t now;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t idle = 0;
+
 	int i;
 
-	s = sched_init();
+	s = sched_init(throttle_queue);
 
 	for (i = 0; i < num_classes; i++) {
 		struct tc_params params = {
@@ -796,12 +1575,280 @@ void sched_test_perf()
 
 		if (i % 2 == 0)
 			params.limit[RESOURCE_BIT] = 100e6;
+
+		snprintf(params.name, sizeof(params.name), "test_perf%d", i);
 		
 		classes[i] = tc_init(s, &params);
+		assert(!is_err(classes[i]));
 	}
 
 	for (i = 0; i < num_classes; i++)
 		tc_join(classes[i]);
 
-	sched_loop(s);
+	now = rdtsc();
+	start = rdtsc();
+
+	for (int round = 0; round < num_rounds; round++) {
+		resource_arr_t usage;
+		struct tc *c;
+
+		now += round_cycles;
+
+		c = sched_next(s, now);
+		if (!c) {
+			idle++;
+			continue;
+		}
+
+		usage[RESOURCE_CNT] = 1;
+		usage[RESOURCE_CYCLE] = round_cycles;
+		usage[RESOURCE_PACKET] = 32;
+		usage[RESOURCE_BIT] = 32 * 84 * 8;
+
+		sched_done(s, c, usage, 1, now);
+	}
+
+	elapsed = rdtsc() - start;
+
+	log_info("SCHED: %-5s %6d classes: %.1f cycles/round "
+			"(%.1f%% idle)\n",
+			throttle_queue == THROTTLE_QUEUE_WHEEL ? "wheel" : "heap",
+			num_classes, (double)elapsed / num_rounds,
+			idle * 100.0 / num_rounds);
+
+	sched_free(s);
+
+	for (i = 0; i < num_classes; i++)
+		tc_dec_refcnt(classes[i]);
+}
+
+/* Compares the jitter of periodic classes, scheduled either with the stride
+ * policy (rate-limited to once per period) or with the EDF policy, both at 
+ * a higher priority than bulk classes. Runs in simulated time */
+static void sched_test_edf(void)
+{
+	const int num_bulk = 50;
+	const uint64_t bulk_cycles = 2000;	/* per invocation */
+	const uint64_t periodic_cycles = 200;
+	const int num_rounds = 10000000;
+
+	const uint64_t periods_us[] = {10, 20, 50, 100};
+	const int num_periodic = sizeof(periods_us) / sizeof(uint64_t);
+
+	for (int policy = PGROUP_POLICY_STRIDE; policy <= PGROUP_POLICY_EDF;
+			policy++) 
+	{
+		struct sched *s;
+		struct tc *bulk[num_bulk];
+		struct tc *periodic[num_periodic];
+
+		uint64_t last_run[num_periodic];
+		uint64_t runs[num_periodic];
+		uint64_t sum_jitter[num_periodic];
+		uint64_t max_jitter[num_periodic];
+
+		uint64_t now;
+		int i;
+
+		s = sched_init(THROTTLE_QUEUE_HEAP);
+
+		for (i = 0; i < num_bulk; i++) {
+			struct tc_params params = {
+				.priority = 0,
+				.share = 1,
+				.share_resource = RESOURCE_CNT,
+			};
+
+			snprintf(params.name, sizeof(params.name),
+					"test_bulk%d", i);
+
+			bulk[i] = tc_init(s, &params);
+			assert(!is_err(bulk[i]));
+			tc_join(bulk[i]);
+		}
+
+		for (i = 0; i < num_periodic; i++) {
+			struct tc_params params = {
+				.priority = 1,
+				.share = 1,
+				.share_resource = RESOURCE_CNT,
+			};
+
+			if (policy == PGROUP_POLICY_EDF)
+				params.period_ns = periods_us[i] * 1000;
+			else
+				params.limit[RESOURCE_CNT] = 
+						1000000 / periods_us[i];
+
+			snprintf(params.name, sizeof(params.name),
+					"test_periodic%d", i);
+
+			periodic[i] = tc_init(s, &params);
+			assert(!is_err(periodic[i]));
+			tc_join(periodic[i]);
+
+			last_run[i] = runs[i] = 0;
+			sum_jitter[i] = max_jitter[i] = 0;
+		}
+
+		now = rdtsc();
+
+		for (int round = 0; round < num_rounds; round++) {
+			resource_arr_t usage = {0};
+			struct tc *c;
+			int j;
+
+			c = sched_next(s, now);
+			if (!c) {
+				now += 100;
+				continue;
+			}
+
+			for (j = 0; j < num_periodic; j++)
+				if (c == periodic[j])
+					break;
+
+			if (j < num_periodic) {
+				uint64_t period = periods_us[j] * tsc_hz / 
+						1000000;
+
+				if (last_run[j]) {
+					uint64_t interval = now - last_run[j];
+					uint64_t jitter = (interval > period) ?
+						interval - period : 
+						period - interval;
+
+					runs[j]++;
+					sum_jitter[j] += jitter;
+					max_jitter[j] = RTE_MAX(max_jitter[j],
+							jitter);
+				}
+
+				last_run[j] = now;
+				usage[RESOURCE_CYCLE] = periodic_cycles;
+			} else
+				usage[RESOURCE_CYCLE] = bulk_cycles;
+
+			usage[RESOURCE_CNT] = 1;
+			now += usage[RESOURCE_CYCLE];
+
+			sched_done(s, c, usage, 1, now);
+		}
+
+		for (i = 0; i < num_periodic; i++)
+			log_info("SCHED: %-6s period %3luus: %8lu runs, "
+					"jitter avg %.2fus max %.2fus, "
+					"%lu missed\n",
+					policy == PGROUP_POLICY_EDF ? 
+						"edf" : "stride",
+					periods_us[i], runs[i], 
+					runs[i] ? sum_jitter[i] * 1e6 / 
+						tsc_hz / runs[i] : 0.0,
+					max_jitter[i] * 1e6 / tsc_hz,
+					periodic[i]->edf.missed);
+
+		sched_free(s);
+
+		for (i = 0; i < num_bulk; i++)
+			tc_dec_refcnt(bulk[i]);
+
+		for (i = 0; i < num_periodic; i++)
+			tc_dec_refcnt(periodic[i]);
+	}
+}
+
+/* A producer TC that overflows a ring, as Queue does, must be throttled
+ * for the backoff period and then resumed */
+static void sched_test_backpressure(void)
+{
+	const uint64_t backoff_tsc = tsc_hz / 10000;	/* 100us */
+	const int slots = 64;
+
+	struct tc_params params = {
+		.name = "test_bp",
+		.priority = 0,
+		.share = 1,
+		.share_resource = RESOURCE_CNT,
+	};
+
+	resource_arr_t usage = {[RESOURCE_CNT] = 1};
+
+	struct sched *s;
+	struct tc *c;
+	struct llring *ring;
+	void *objs[MAX_PKT_BURST] = {NULL};
+
+	uint64_t now;
+	int rounds = 0;
+	int ret;
+
+	s = sched_init(THROTTLE_QUEUE_HEAP);
+
+	c = tc_init(s, &params);
+	assert(!is_err(c));
+	tc_join(c);
+
+	ring = rte_zmalloc("test_bp", llring_bytes_with_slots(slots), 0);
+	assert(ring);
+	ret = llring_init(ring, slots, 1, 1);
+	assert(ret == 0);
+
+	now = rdtsc();
+
+	/* nobody drains the ring, so it fills up in a few rounds */
+	for (;;) {
+		int queued;
+
+		assert(sched_next(s, now) == c);
+		rounds++;
+
+		ret = llring_sp_enqueue_burst(ring, objs, MAX_PKT_BURST);
+		queued = ret & RING_SZ_MASK;
+		if ((ret & RING_QUOT_EXCEED) || queued < MAX_PKT_BURST)
+			sched_backpressure(s, backoff_tsc);
+
+		sched_done(s, c, usage, 1, now);
+
+		if (queued < MAX_PKT_BURST)
+			break;
+
+		now++;
+	}
+
+	assert(llring_count(ring) == slots - 1);
+
+	/* the ring stays full. no more rounds until the backoff is over */
+	assert(sched_next(s, now + backoff_tsc - 1) == NULL);
+	assert(sched_next(s, now + backoff_tsc) == c);
+	sched_done(s, c, usage, 1, now + backoff_tsc);
+
+	log_info("SCHED: backpressure test passed "
+			"(throttled after %d rounds)\n", rounds);
+
+	rte_free(ring);
+
+	sched_free(s);
+	tc_dec_refcnt(c);
+}
+
+int sched_test(const char *name)
+{
+	/* CPU bound, cache bound, and throttled queue bound */
+	const int perf_classes[] = {50, 1000, 10000};
+
+	if (strcmp(name, "alloc") == 0) {
+		sched_test_alloc();
+	} else if (strcmp(name, "perf") == 0) {
+		for (int i = 0; i < 3; i++) {
+			sched_test_perf(THROTTLE_QUEUE_HEAP, perf_classes[i]);
+			sched_test_perf(THROTTLE_QUEUE_WHEEL, perf_classes[i]);
+		}
+	} else if (strcmp(name, "edf") == 0) {
+		sched_test_edf();
+	} else if (strcmp(name, "backpressure") == 0) {
+		sched_test_backpressure();
+	} else
+		return -EINVAL;
+
+	return 0;
 }
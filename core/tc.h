@@ -5,10 +5,14 @@
 
 #include "common.h"
 #include "namespace.h"
+#include "pktbatch.h"
 
 #include "utils/minheap.h"
 #include "utils/cdlist.h"
 #include "utils/simd.h"
+#include "utils/wsdeque.h"
+#include "utils/timerwheel.h"
+#include "utils/seqlock.h"
 
 #define SCHED_DEBUG		0
 
@@ -25,20 +29,39 @@ enum {
 	NUM_RESOURCES,		/* Sentinel. Do not use. */
 };
 
+/* how throttled TCs are queued until they are resumed */
+enum {
+	THROTTLE_QUEUE_HEAP = 0,	/* binary heap. exact but O(log n) */
+	THROTTLE_QUEUE_WHEEL,		/* timing wheel. O(1), ~1us precision */
+};
+
 /* share is defined relatively, so 1024 should be large enough */
 #define MAX_SHARE	(1 << 10)
 #define STRIDE1		(1 << 20)
 
+/* Packet-receiving tasks process up to this many packets per invocation,
+ * in batches of MAX_PKT_BURST. See sched_current_burst() */
+#define MAX_TC_BURST	(MAX_PKT_BURST * 8)
+
 /* this doesn't mean anything, other than avoiding int64 overflow */
-#define QUANTUM		(1 << 10)
+#define QUANTUM_POW	10
+#define QUANTUM		(1 << QUANTUM_POW)
 
 typedef uint64_t resource_arr_t[NUM_RESOURCES] __ymm_aligned;
 
-/* pgroup is a collection of sibling classes with the same priority */
+/* how classes in a pgroup are scheduled */
+enum {
+	PGROUP_POLICY_STRIDE = 0,	/* proportional to shares */
+	PGROUP_POLICY_EDF,		/* periodic, earliest deadline first */
+};
+
+/* pgroup is a collection of sibling classes with the same priority 
+ * and policy. Among pgroups of the same priority, EDF goes first */
 struct pgroup {
-	struct heap pq;
+	struct heap pq;		/* keyed by ss.pass, or edf.deadline */
 
 	int32_t priority;
+	int policy;
 
 	int resource;		/* [0, NUM_RESOURCES - 1] */
 	int num_children;
@@ -55,6 +78,9 @@ struct tc_params {
 	 * (if its last task is detached, free the tc as well) */
 	int auto_free;		
 
+	/* Can be stolen by idle workers? (only for children of the root) */
+	int migratable;
+
 	int32_t priority;
 
 	int32_t share;
@@ -62,6 +88,22 @@ struct tc_params {
 
 	uint64_t limit[NUM_RESOURCES];	/* in work units per sec. 0 if unlimited */
 	uint64_t max_burst[NUM_RESOURCES];
+
+	/* If nonzero, the burst size of the tasks is adjusted so that
+	 * processing a burst takes no longer than this. 
+	 * Otherwise MAX_PKT_BURST */
+	uint64_t target_latency_ns;
+
+	/* If nonzero, the class is scheduled once per period, 
+	 * with the EDF policy (see struct pgroup) */
+	uint64_t period_ns;
+
+	/* If nonzero, each time the class is scheduled, its tasks run in
+	 * round robin for up to quantum_tasks invocations (and quantum_ns,
+	 * if nonzero), before a single accounting. Otherwise, until a task
+	 * returns some packets */
+	uint32_t quantum_tasks;
+	uint64_t quantum_ns;
 };
 
 struct tc_stats {
@@ -69,6 +111,14 @@ struct tc_stats {
 	uint64_t cnt_throttled;
 };
 
+/* Published periodically by the owner worker (see sched_publish_stats()),
+ * so that other threads can read consistent stats without racing */
+struct tc_snapshot {
+	uint64_t tsc;			/* when taken. 0 if never */
+	struct tc_stats stats;		/* cumulative */
+	struct tc_stats rates;		/* per second, since the last one */
+};
+
 /***************************************************************************
  * Any change to the layout of this struct may affect performance.
  * Please group fields in a way that maximizes spatial cache locality.
@@ -116,21 +166,47 @@ struct tc {
 		int64_t remain;
 	} ss;
 
+	/* for PGROUP_POLICY_EDF. Runs once per period, 
+	 * no earlier than (deadline - period) */
+	struct {
+		uint64_t period_tsc;	/* 0 for PGROUP_POLICY_STRIDE */
+		uint64_t deadline;
+		uint64_t missed;	/* ran past its deadline */
+	} edf;
+
 	struct tc_stats stats;
 
+	/* how many packets its tasks should process per invocation */
+	uint32_t burst;
+
+	/* see tc_params. quantum_tasks is 0 if disabled */
+	uint32_t quantum_tasks;
+	uint64_t quantum_tsc;
+
+	/* for adaptive burst size (see tc_adapt_burst()) */
+	uint64_t target_latency_tsc;	/* 0 if burst is fixed */
+	uint64_t avg_cycles;		/* moving average per invocation */
+	uint64_t avg_packets;		/* (x 2^8 for precision) */
+
 	/* For per-resource token buckets: 
 	 * 1 work unit = 2 ^ USAGE_AMPLIFIER_POW resource usage.
 	 * (for better precision without using floating point numbers) 
 	 *
 	 * prof->limit < 2^36 (~64 Tbps)
 	 * 2^24 < tsc_hz < 2^34 (16 Mhz - 16 GHz)
-	 * tb->limit < 2^36 */
+	 * tb->limit < 2^36 
+	 *
+	 * All fields are 0 for unlimited resources. */
 	struct {
 		/* how many work units per (10*9/hz) sec. 0 if unlimited */
-		uint64_t limit;		
-		uint64_t max_burst;	/* in work units */
-		uint64_t tokens;	/* in work units */
-	} tb[NUM_RESOURCES];
+		resource_arr_t limit;		
+		resource_arr_t limit_recip;	/* (2^64 - 1) / limit */
+		resource_arr_t max_burst;	/* in work units */
+		resource_arr_t tokens;		/* in work units */
+	} tb;
+
+	/* for THROTTLE_QUEUE_WHEEL (when throttled == 1) */
+	struct tw_timer throttle_timer;
 
 	/****************************************************************
 	 * Not used in the "datapath" (sched_next or sched_done)
@@ -142,31 +218,69 @@ struct tc {
 
 	int32_t priority;		/* the higher, the more important */
 	int auto_free;			/* is this TC ephemeral? */
+	int share_resource;
+
+	int migratable;
+	uint64_t migrated_tsc;		/* when was it last moved? */
+	uint64_t throttled_until;	/* valid only while detached */
+	struct sched *migrate_dst;	/* see sched_migrate_tc() */
 
-	/* linked list of all classes belonging to the same scheduler */
+	/* linked list of all classes belonging to the same scheduler.
+	 * While a subtree is detached (see sched_remove_tc()), 
+	 * its classes are linked through this field of the subtree root. */
 	struct cdlist_item sched_all;
 
 	struct tc_stats last_stats;
+
+	seqlock_t snap_lock;
+	struct tc_snapshot snap;
 };
 
+struct llring;
+
 struct sched_stats {
 	resource_arr_t usage;
 	uint64_t cnt_idle;
 	uint64_t cycles_idle;
 };
 
+struct sched_snapshot {
+	uint64_t tsc;
+	struct sched_stats stats;
+	struct sched_stats rates;
+};
+
 struct sched {
 	struct tc root;			/* Must be the first field */
 	struct tc *current;		/* currently running */
 
-	/* priority queue of inactive (throttled) token buckets */
-	struct heap pq;
+	/* queue of inactive (throttled) token buckets */
+	int throttle_queue;
+	union {
+		struct heap pq;			/* THROTTLE_QUEUE_HEAP */
+		struct timer_wheel wheel;	/* THROTTLE_QUEUE_WHEEL */
+	};
+
+	/* requested by sched_backpressure() while the current TC is running.
+	 * consumed (and reset) by sched_done() */
+	uint64_t backpressure_tsc;
 
 	struct sched_stats stats;
 
 	/* all traffic classes, except the root TC */
 	int num_classes;
 	struct cdlist_head tcs_all;
+
+	uint64_t cnt_stolen;		/* TCs taken from other workers */
+	uint64_t cnt_given;		/* TCs taken by other workers */
+
+	/* messages from the master or other workers (see sched_migrate_tc).
+	 * Multi-producer, single-consumer */
+	struct llring *inbox;
+	int wid;			/* the owner, to wake up on messages */
+
+	seqlock_t snap_lock;
+	struct sched_snapshot snap;
 };
 
 struct tc *tc_init(struct sched *s, const struct tc_params *prof);
@@ -187,15 +301,55 @@ static inline void tc_dec_refcnt(struct tc *c)
 		_tc_do_free(c);
 }
 
-struct sched *sched_init();
+struct sched *sched_init(int throttle_queue);
 void sched_free(struct sched *s);
 
+/* Moves a child of the root (and its subtree) between schedulers. 
+ * Must not be called while the scheduler is running a task. */
+void sched_remove_tc(struct tc *c);
+void sched_add_tc(struct sched *s, struct tc *c);
+
+/* Moves c (a non-migratable child of the root) from its scheduler to dst,
+ * while both are running. Called by the master. The source worker detaches
+ * c and passes it to the destination worker via their inboxes, so c is
+ * never scheduled by both. Returns immediately; c->s becomes dst once done */
+int sched_migrate_tc(struct tc *c, struct sched *dst);
+
+/* Withdraws a migration to dst, unless the source worker has already
+ * detached c. Returns 0 if withdrawn (c stays on its worker) */
+int sched_cancel_migration(struct tc *c, struct sched *dst);
+
+/* Called by the master after pausing all workers. Attaches the TCs still
+ * in transit (in an inbox or offered for stealing) to a scheduler */
+void sched_settle_all(void);
+
+/* May be called by modules while a task is running (e.g., by a Queue whose
+ * high water mark is exceeded). The currently running TC will be throttled
+ * for at least wait_tsc cycles once the task returns. */
+static inline void sched_backpressure(struct sched *s, uint64_t wait_tsc)
+{
+	if (wait_tsc > s->backpressure_tsc)
+		s->backpressure_tsc = wait_tsc;
+}
+
+/* The number of packets the currently running task should process */
+static inline uint32_t sched_current_burst(const struct sched *s)
+{
+	return s->current ? s->current->burst : MAX_PKT_BURST;
+}
+
+/* For non-worker threads. Copies the last published stats */
+void tc_get_snapshot(const struct tc *c, struct tc_snapshot *snap);
+void sched_get_snapshot(const struct sched *s, struct sched_snapshot *snap);
+
 //struct tc *sched_next(struct sched *s);
 //void sched_done(struct sched *s, const uint32_t *usage, int reschedule);
 
 void sched_loop(struct sched *s);
 
-void sched_test_alloc();
-void sched_test_perf();
+/* Runs a scheduler test on the calling (non-worker) thread, by name:
+ * "alloc", "perf" (heap vs. timing wheel), or "edf" (EDF vs. stride).
+ * Returns -EINVAL if there is no such test. See "bessd -b" */
+int sched_test(const char *name);
 
 #endif
@@ -149,4 +149,62 @@ static void heap_pop(struct heap *h)
 	heap_replace(h, val, data);
 }
 
+/* Removes an arbitrary node in O(n) time. Returns -1 if data is not found.
+ * The value of the node is stored in *ret_val, if not NULL */
+static int heap_remove(struct heap *h, void *data, int64_t *ret_val)
+{
+	uint32_t num_nodes = h->num_nodes;
+	int64_t *arr_v = h->arr_v;
+	void **arr_d = h->arr_d;
+
+	/* of the replacing (the last) node */
+	int64_t val;
+	void *last;
+
+	uint32_t i;
+	uint32_t c;
+
+	for (i = 1; i <= num_nodes; i++)
+		if (arr_d[i] == data)
+			break;
+
+	if (i > num_nodes)
+		return -1;
+
+	if (ret_val)
+		*ret_val = arr_v[i];
+
+	val = arr_v[num_nodes];
+	last = arr_d[num_nodes];
+	arr_v[num_nodes] = INT64_MAX;
+	arr_d[num_nodes] = NULL;
+	h->num_nodes = --num_nodes;
+
+	/* was it the last node? */
+	if (i > num_nodes)
+		return 0;
+
+	while (val < arr_v[i / 2]) {
+		arr_v[i] = arr_v[i / 2];
+		arr_d[i] = arr_d[i / 2];
+		i = i / 2;
+	}
+
+	for (c = i * 2; ; c = i * 2) {
+		c += (arr_v[c] > arr_v[c + 1]);
+
+		if (val <= arr_v[c])
+			break;
+
+		arr_v[i] = arr_v[c];
+		arr_d[i] = arr_d[c];
+		i = c;
+	}
+
+	arr_v[i] = val;
+	arr_d[i] = last;
+
+	return 0;
+}
+
 #endif
@@ -0,0 +1,63 @@
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <stdint.h>
+
+#include <x86intrin.h>
+
+#include "../common.h"
+
+/* Sequence lock for a single writer and any number of readers.
+ * Readers never block the writer; they retry if the data was being
+ * written while they were reading it.
+ *
+ * Reader:
+ * 	do {
+ * 		seq = seqlock_read_begin(&lock);
+ * 		copy = data;
+ * 	} while (seqlock_read_retry(&lock, seq));
+ */
+
+struct seqlock {
+	volatile uint32_t seq;		/* odd while being written */
+};
+
+typedef struct seqlock seqlock_t;
+
+static inline void seqlock_init(seqlock_t *lock)
+{
+	lock->seq = 0;
+}
+
+static inline void seqlock_write_begin(seqlock_t *lock)
+{
+	lock->seq++;
+	STORE_BARRIER();
+}
+
+static inline void seqlock_write_end(seqlock_t *lock)
+{
+	STORE_BARRIER();
+	lock->seq++;
+}
+
+static inline uint32_t seqlock_read_begin(const seqlock_t *lock)
+{
+	uint32_t seq;
+
+	while ((seq = lock->seq) & 1)
+		_mm_pause();
+
+	LOAD_BARRIER();
+
+	return seq;
+}
+
+static inline int seqlock_read_retry(const seqlock_t *lock, uint32_t seq)
+{
+	LOAD_BARRIER();
+
+	return lock->seq != seq;
+}
+
+#endif
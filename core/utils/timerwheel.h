@@ -0,0 +1,197 @@
+#ifndef _TIMERWHEEL_H_
+#define _TIMERWHEEL_H_
+
+#include <stdint.h>
+
+#include <rte_malloc.h>
+
+#include "cdlist.h"
+
+/* Single-level timing wheel (a.k.a. calendar queue) with an overflow list.
+ * Time is divided into ticks of 2^shift TSC cycles, and each of the
+ * num_buckets buckets holds the timers of a tick in the current window
+ * [next_tick, next_tick + num_buckets). Timers beyond the window are kept in
+ * the overflow list, and moved into the wheel every num_buckets ticks.
+ *
+ * Insertion and removal are O(1). Expired timers are popped in tick order
+ * (not in the exact order of their expiry), at most one tick early. */
+
+struct tw_timer {
+	struct cdlist_item bucket;
+	uint64_t expiry;
+	int in_overflow;
+};
+
+struct timer_wheel {
+	uint64_t next_tick;	/* the oldest tick that may have timers */
+	uint64_t mask;		/* num_buckets - 1 */
+	int shift;
+
+	uint32_t num_wheel;	/* number of timers in the buckets */
+	uint32_t num_overflow;
+
+	struct cdlist_head *buckets;
+	struct cdlist_head overflow;
+};
+
+/* num_buckets must be a power of 2 */
+static inline int tw_init(struct timer_wheel *tw, int shift,
+		uint32_t num_buckets, uint64_t now)
+{
+	tw->buckets = rte_malloc("timer_wheel",
+			sizeof(struct cdlist_head) * num_buckets, 0);
+	if (!tw->buckets)
+		return -ENOMEM;
+
+	for (uint32_t i = 0; i < num_buckets; i++)
+		cdlist_head_init(&tw->buckets[i]);
+
+	cdlist_head_init(&tw->overflow);
+
+	tw->next_tick = now >> shift;
+	tw->mask = num_buckets - 1;
+	tw->shift = shift;
+	tw->num_wheel = 0;
+	tw->num_overflow = 0;
+
+	return 0;
+}
+
+static inline void tw_close(struct timer_wheel *tw)
+{
+	rte_free(tw->buckets);
+}
+
+static inline uint32_t tw_count(const struct timer_wheel *tw)
+{
+	return tw->num_wheel + tw->num_overflow;
+}
+
+static inline void __tw_add_wheel(struct timer_wheel *tw, struct tw_timer *t)
+{
+	uint64_t tick = t->expiry >> tw->shift;
+
+	/* already expired? it will be popped first */
+	if (tick < tw->next_tick)
+		tick = tw->next_tick;
+
+	cdlist_add_tail(&tw->buckets[tick & tw->mask], &t->bucket);
+	t->in_overflow = 0;
+	tw->num_wheel++;
+}
+
+static inline void tw_add(struct timer_wheel *tw, struct tw_timer *t,
+		uint64_t expiry)
+{
+	t->expiry = expiry;
+
+	if ((expiry >> tw->shift) < tw->next_tick + tw->mask + 1) {
+		__tw_add_wheel(tw, t);
+	} else {
+		cdlist_add_tail(&tw->overflow, &t->bucket);
+		t->in_overflow = 1;
+		tw->num_overflow++;
+	}
+}
+
+static inline void tw_remove(struct timer_wheel *tw, struct tw_timer *t)
+{
+	cdlist_del(&t->bucket);
+
+	if (t->in_overflow)
+		tw->num_overflow--;
+	else
+		tw->num_wheel--;
+}
+
+/* Returns the earliest time tw_pop_expired() may return a timer, or
+ * UINT64_MAX if there is no timer. O(num_buckets) at worst, plus O(n) for
+ * the overflow list if the wheel is empty. Not for the fast path */
+static inline uint64_t tw_next_expiry(const struct timer_wheel *tw)
+{
+	uint64_t earliest = UINT64_MAX;
+
+	if (tw->num_wheel) {
+		for (uint64_t i = 0; i <= tw->mask; i++) {
+			uint64_t tick = tw->next_tick + i;
+
+			if (!cdlist_is_empty(&tw->buckets[tick & tw->mask]))
+				return tick << tw->shift;
+		}
+	}
+
+	if (tw->num_overflow) {
+		struct tw_timer *t;
+
+		cdlist_for_each_entry(t, &tw->overflow, bucket)
+			if (t->expiry < earliest)
+				earliest = t->expiry;
+
+		earliest = (earliest >> tw->shift) << tw->shift;
+	}
+
+	return earliest;
+}
+
+/* Moves overflown timers that now fall in the window, into the wheel */
+static void tw_cascade(struct timer_wheel *tw)
+{
+	struct tw_timer *t;
+	struct tw_timer *next;
+
+	const uint64_t end = tw->next_tick + tw->mask + 1;
+
+	cdlist_for_each_entry_safe(t, next, &tw->overflow, bucket) {
+		if ((t->expiry >> tw->shift) >= end)
+			continue;
+
+		cdlist_del(&t->bucket);
+		tw->num_overflow--;
+		__tw_add_wheel(tw, t);
+	}
+}
+
+/* Returns an expired timer (removed from the wheel), or NULL if none */
+static inline struct tw_timer *tw_pop_expired(struct timer_wheel *tw,
+		uint64_t now)
+{
+	const uint64_t now_tick = now >> tw->shift;
+
+	while (tw->next_tick <= now_tick) {
+		struct cdlist_head *b = &tw->buckets[tw->next_tick & tw->mask];
+
+		if (!cdlist_is_empty(b)) {
+			struct tw_timer *t;
+
+			t = container_of(b->next, struct tw_timer, bucket);
+			cdlist_del(&t->bucket);
+			tw->num_wheel--;
+			return t;
+		}
+
+		/* stay here, so that timers added later in this tick 
+		 * can be popped without delay */
+		if (tw->next_tick == now_tick)
+			return NULL;
+
+		if (tw->num_wheel == 0) {
+			/* skip to the next window, if nothing to cascade */
+			uint64_t boundary = (tw->next_tick | tw->mask) + 1;
+
+			if (boundary > now_tick || tw->num_overflow == 0) {
+				tw->next_tick = now_tick;
+				return NULL;
+			}
+
+			tw->next_tick = boundary;
+		} else
+			tw->next_tick++;
+
+		if ((tw->next_tick & tw->mask) == 0)
+			tw_cascade(tw);
+	}
+
+	return NULL;
+}
+
+#endif
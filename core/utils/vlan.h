@@ -0,0 +1,80 @@
+#ifndef _VLAN_H_
+#define _VLAN_H_
+
+#include <stdint.h>
+
+#include <x86intrin.h>
+
+/* Helpers to process the Ethernet headers of 4 frames at once.
+ * A 64-bit word of bytes 8-15 (the last 4 bytes of the source MAC address,
+ * TPID, and TCI) is gathered from each frame, so that TPID detection and
+ * VID extraction can be done without branches. */
+
+/* TPID values as they appear in a little-endian 16-bit load */
+#define VLAN_TPID_8021Q_LE	0x0081	/* 0x8100 */
+#define VLAN_TPID_8021AD_LE	0xa888	/* 0x88a8 (QinQ) */
+
+#if __AVX2__
+
+static inline __m256i vlan_gather_x4(char * const heads[4])
+{
+	__m256i addrs = _mm256_loadu_si256((__m256i *)heads);
+
+	addrs = _mm256_add_epi64(addrs, _mm256_set1_epi64x(8));
+
+	return _mm256_i64gather_epi64(NULL, addrs, 1);
+}
+
+static inline __m256i vlan_tpid_x4(__m256i w)
+{
+	return _mm256_and_si256(_mm256_srli_epi64(w, 32),
+			_mm256_set1_epi64x(0xffff));
+}
+
+/* bit i is set iff the i-th frame is 802.1Q tagged */
+static inline int vlan_ctagged_mask_x4(__m256i w)
+{
+	__m256i q = _mm256_cmpeq_epi64(vlan_tpid_x4(w),
+			_mm256_set1_epi64x(VLAN_TPID_8021Q_LE));
+
+	return _mm256_movemask_pd(_mm256_castsi256_pd(q));
+}
+
+/* bit i is set iff the i-th frame is 802.1Q or 802.1ad tagged */
+static inline int vlan_tagged_mask_x4(__m256i w)
+{
+	__m256i tpid = vlan_tpid_x4(w);
+	__m256i q = _mm256_cmpeq_epi64(tpid,
+			_mm256_set1_epi64x(VLAN_TPID_8021Q_LE));
+	__m256i ad = _mm256_cmpeq_epi64(tpid,
+			_mm256_set1_epi64x(VLAN_TPID_8021AD_LE));
+
+	return _mm256_movemask_pd(_mm256_castsi256_pd(
+				_mm256_or_si256(q, ad)));
+}
+
+/* VID (in host order) of the outer tag, valid only for tagged frames */
+static inline __m256i vlan_vid_x4(__m256i w)
+{
+	/* TCI is in bits 48-63, in network order */
+	__m256i lo = _mm256_srli_epi64(w, 56);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi64(w, 40),
+			_mm256_set1_epi64x(0x0f00));
+
+	return _mm256_or_si256(hi, lo);
+}
+
+/* Moves the MAC addresses 4 bytes forward, overwriting the outer tag,
+ * iff tagged == 1. Does nothing (but a store) if tagged == 0 */
+static inline void vlan_strip_hdr(char *head, int tagged)
+{
+	__m128i ethh = _mm_loadu_si128((__m128i *)head);
+
+	ethh = _mm_blendv_epi8(ethh, _mm_slli_si128(ethh, 4),
+			_mm_set1_epi8(-tagged));
+	_mm_storeu_si128((__m128i *)head, ethh);
+}
+
+#endif /* __AVX2__ */
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _WSDEQUE_H_
+#define _WSDEQUE_H_
+
+#include <stdint.h>
+
+#include "../common.h"
+
+/* Fixed-size work-stealing deque (Chase and Lev, SPAA '05).
+ * Only the owner calls wsdeque_push() and wsdeque_pop() at the bottom,
+ * while any thread may call wsdeque_steal() at the top.
+ * Each pushed item is returned exactly once, either by pop or steal. */
+
+#define WSDEQUE_SIZE	16	/* must be a power of 2 */
+
+struct wsdeque {
+	volatile int64_t top;
+	volatile int64_t bottom;
+
+	void * volatile items[WSDEQUE_SIZE];
+} __cacheline_aligned;
+
+static inline void wsdeque_init(struct wsdeque *d)
+{
+	d->top = 0;
+	d->bottom = 0;
+}
+
+static inline int wsdeque_is_empty(const struct wsdeque *d)
+{
+	return d->bottom <= d->top;
+}
+
+/* returns -1 if full */
+static inline int wsdeque_push(struct wsdeque *d, void *item)
+{
+	int64_t b = d->bottom;
+	int64_t t = d->top;
+
+	if (b - t >= WSDEQUE_SIZE)
+		return -1;
+
+	d->items[b & (WSDEQUE_SIZE - 1)] = item;
+
+	/* the item must be visible before the new bottom */
+	STORE_BARRIER();
+	d->bottom = b + 1;
+
+	return 0;
+}
+
+/* returns NULL if empty (or the last item has been stolen) */
+static inline void *wsdeque_pop(struct wsdeque *d)
+{
+	int64_t b = d->bottom - 1;
+	int64_t t;
+	void *item;
+
+	d->bottom = b;
+
+	/* the new bottom must be visible before reading top */
+	FULL_BARRIER();
+	t = d->top;
+
+	if (t > b) {
+		d->bottom = b + 1;
+		return NULL;
+	}
+
+	item = d->items[b & (WSDEQUE_SIZE - 1)];
+
+	/* the last item? race against thieves */
+	if (t == b) {
+		if (!__sync_bool_compare_and_swap(&d->top, t, t + 1))
+			item = NULL;
+
+		d->bottom = b + 1;
+	}
+
+	return item;
+}
+
+/* returns NULL if empty or lost the race */
+static inline void *wsdeque_steal(struct wsdeque *d)
+{
+	int64_t t = d->top;
+	int64_t b;
+	void *item;
+
+	LOAD_BARRIER();
+	b = d->bottom;
+
+	if (t >= b)
+		return NULL;
+
+	item = d->items[t & (WSDEQUE_SIZE - 1)];
+
+	if (!__sync_bool_compare_and_swap(&d->top, t, t + 1))
+		return NULL;
+
+	return item;
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include <sched.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <poll.h>
 #include <sys/eventfd.h>
 
 #include <rte_config.h>
@@ -44,6 +46,7 @@ void set_non_worker()
 	ctx.core = INT_MIN;
 	ctx.socket = INT_MIN;
 	ctx.fd_event = INT_MIN;
+	ctx.fd_wakeup = INT_MIN;
 
 	/* Packet pools should be available to non-worker threads */
 	for (socket = 0; socket < RTE_MAX_NUMA_NODES; socket++) {
@@ -72,6 +75,8 @@ static void pause_worker(int wid)
 
 		FULL_BARRIER();
 
+		wakeup_worker(wid);
+
 		while (workers[wid]->status == WORKER_PAUSING)
 			; 	/* spin */
 	}
@@ -81,6 +86,9 @@ void pause_all_workers()
 {
 	for (int wid = 0; wid < MAX_WORKERS; wid++)
 		pause_worker(wid);
+
+	/* a worker may have passed a TC to another one that paused earlier */
+	sched_settle_all();
 }
 
 #define SIGNAL_UNBLOCK	1
@@ -134,6 +142,45 @@ void destroy_all_workers()
 		destroy_worker(wid);
 }
 
+int set_worker_idle(int wid, int mode, uint32_t sleep_rounds,
+		uint32_t max_sleep_us)
+{
+	struct worker_context *w = workers[wid];
+
+	if (!w)
+		return -ENOENT;
+
+	if (mode < IDLE_MODE_SPIN || mode > IDLE_MODE_SLEEP)
+		return -EINVAL;
+
+	w->idle_sleep_rounds = sleep_rounds;
+	w->idle_max_sleep_us = max_sleep_us;
+
+	STORE_BARRIER();
+	w->idle_mode = mode;
+
+	/* let it notice the new setting */
+	wakeup_worker(wid);
+
+	return 0;
+}
+
+void wakeup_worker(int wid)
+{
+	struct worker_context *w = workers[wid];
+	int ret;
+
+	/* A wakeup racing with the worker going to sleep may be missed,
+	 * but then it only sleeps up to idle_max_sleep_us */
+	if (!w || !w->sleeping)
+		return;
+
+	w->wakeup_tsc = rdtsc();
+
+	ret = write(w->fd_wakeup, &(uint64_t){1}, sizeof(uint64_t));
+	assert(ret == sizeof(uint64_t));
+}
+
 int is_any_worker_running()
 {
 	int wid;
@@ -166,6 +213,53 @@ int block_worker()
 	return 0;
 }
 
+void worker_sleep(uint64_t timeout_ns)
+{
+	struct pollfd pfd = {.fd = ctx.fd_wakeup, .events = POLLIN};
+	struct timespec ts = {
+		.tv_sec = timeout_ns / 1000000000,
+		.tv_nsec = timeout_ns % 1000000000,
+	};
+
+	uint64_t start;
+	uint64_t now;
+	int ret;
+
+	ctx.sleeping = 1;
+	FULL_BARRIER();
+
+	start = rdtsc();
+	ret = ppoll(&pfd, 1, &ts, NULL);
+
+	ctx.sleeping = 0;
+	now = rdtsc();
+
+	ctx.idle_stats.sleeps++;
+
+	if (ret > 0) {
+		uint64_t t;
+		uint64_t latency;
+
+		ret = read(ctx.fd_wakeup, &t, sizeof(t));
+		assert(ret == sizeof(t));
+
+		/* the wakeup may have been issued before this sleep */
+		latency = now - RTE_MAX(ctx.wakeup_tsc, start);
+
+		ctx.idle_stats.wakeups++;
+		ctx.idle_stats.wakeup_cycles += latency;
+		if (latency > ctx.idle_stats.max_wakeup_cycles)
+			ctx.idle_stats.max_wakeup_cycles = latency;
+	} else {
+		uint64_t timeout_tsc = timeout_ns * tsc_hz / 1000000000;
+		uint64_t oversleep = now - start - 
+			RTE_MIN(timeout_tsc, now - start);
+
+		if (oversleep > ctx.idle_stats.max_oversleep_cycles)
+			ctx.idle_stats.max_oversleep_cycles = oversleep;
+	}
+}
+
 /* arg is the core ID it should run on */
 static int run_worker(void *arg)
 {
@@ -188,8 +282,15 @@ static int run_worker(void *arg)
 	assert(ctx.socket >= 0);	/* shouldn't be SOCKET_ID_ANY (-1) */
 	ctx.fd_event = eventfd(0, 0);
 	assert(ctx.fd_event >= 0);
+	ctx.fd_wakeup = eventfd(0, EFD_NONBLOCK);
+	assert(ctx.fd_wakeup >= 0);
+
+	ctx.idle_mode = IDLE_MODE_SPIN;
+	ctx.idle_sleep_rounds = DEFAULT_IDLE_SLEEP_ROUNDS;
+	ctx.idle_max_sleep_us = DEFAULT_IDLE_MAX_SLEEP_US;
 
-	ctx.s = sched_init();
+	ctx.s = sched_init(global_opts.throttle_wheel ? 
+			THROTTLE_QUEUE_WHEEL : THROTTLE_QUEUE_HEAP);
 
 	ctx.current_tsc = rdtsc();
 
@@ -198,11 +299,6 @@ static int run_worker(void *arg)
 
 	ctx.status = WORKER_PAUSING;
 
-#if 0
-	/* FIXME: when should this be called, avoiding latency */
-	init_module_worker();
-#endif
-
 	STORE_BARRIER();
 	workers[ctx.wid] = &ctx;
 
@@ -223,7 +319,7 @@ static int run_worker(void *arg)
 	return 0;
 }
 
-void launch_worker(int wid, int core)
+int launch_worker(int wid, int core)
 {
 	int ret;
 
@@ -236,4 +332,14 @@ void launch_worker(int wid, int core)
 		;	/* spin until it becomes ready and fully paused */
 
 	num_workers++;
+
+	/* while the worker is paused, before any task runs on it */
+	ret = init_module_worker(wid);
+	if (ret < 0) {
+		log_err("Per-worker module data allocation failed for worker "
+				"%d: %s\n", wid, strerror(-ret));
+		destroy_worker(wid);
+	}
+
+	return ret;
 }
@@ -27,6 +27,16 @@ typedef volatile enum {
 	WORKER_RUNNING,
 } worker_status_t;
 
+/* What a worker does when it has nothing to do (see sched_loop()) */
+enum {
+	IDLE_MODE_SPIN = 0,	/* keep polling (default) */
+	IDLE_MODE_PAUSE,	/* back off with pause instructions */
+	IDLE_MODE_SLEEP,	/* back off, then sleep until woken up */
+};
+
+#define DEFAULT_IDLE_SLEEP_ROUNDS	1024
+#define DEFAULT_IDLE_MAX_SLEEP_US	100
+
 struct worker_context {
 	worker_status_t status;
 
@@ -34,18 +44,43 @@ struct worker_context {
 	int core;		/* TODO: should be cpuset_t */
 	int socket;
 	int fd_event;
+	int fd_wakeup;		/* see wakeup_worker() */
 
 	struct sched *s;
 
+	/* can be changed by the master while running */
+	volatile int idle_mode;
+	volatile uint32_t idle_sleep_rounds;	/* idle rounds before sleep */
+	volatile uint32_t idle_max_sleep_us;	/* bound of each sleep */
+
+	volatile int sleeping;
+	volatile uint64_t wakeup_tsc;	/* when wakeup_worker() was called */
+
+	struct {
+		uint64_t sleeps;
+		uint64_t wakeups;	/* by wakeup_worker(), not timeout */
+		uint64_t wakeup_cycles;	/* sum of wakeup latency */
+		uint64_t max_wakeup_cycles;
+		uint64_t max_oversleep_cycles;	/* beyond the timeout */
+	} idle_stats;
+
 	uint64_t silent_drops;	/* packets that have been sent to a deadend */
 
+	/* received packets, by the socket of their buffers (port_inc etc.) */
+	struct {
+		uint64_t local_pkts;
+		uint64_t remote_pkts;	/* DMA/access across sockets */
+	} numa_stats;
+
 	uint64_t current_tsc;
 	uint64_t current_us;
 
-	struct rte_mempool *pframe_pool;
+	/* input gate of the current process_batch() call (gate_t) */
+	uint16_t igate;
+
+	int profiling;		/* is the current task sampled? (profile.h) */
 
-	/* better be the last field. it's huge */
-	struct pkt_batch splits[MAX_OUTPUT_GATES];
+	struct rte_mempool *pframe_pool;
 };
 
 extern int num_workers;
@@ -67,8 +102,16 @@ int is_any_worker_running();
 
 int is_cpu_present(unsigned int core_id);
 
-/* arg (int) is the core id the worker should run on */
-void launch_worker(int wid, int core);	
+/* arg (int) is the core id the worker should run on.
+ * Returns 0 or -errno */
+int launch_worker(int wid, int core);
+
+int set_worker_idle(int wid, int mode, uint32_t sleep_rounds,
+		uint32_t max_sleep_us);
+
+/* May be called by any thread (e.g., on a new event for the worker).
+ * Cheap if the worker is not sleeping */
+void wakeup_worker(int wid);
 
 static inline int is_worker_active(int wid)
 {
@@ -90,4 +133,7 @@ static inline int is_pause_requested() {
 /* Block myself. Return nonzero if the worker needs to die */
 int block_worker(void);	
 
+/* Sleep up to timeout_ns, unless woken up by wakeup_worker() */
+void worker_sleep(uint64_t timeout_ns);
+
 #endif
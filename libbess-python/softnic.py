@@ -177,9 +177,9 @@ class SoftNIC(object):
     def get_module_info(self, name):
         return self._request_softnic('get_module_info', name)
 
-    def connect_modules(self, m1, m2, gate = 0):
+    def connect_modules(self, m1, m2, gate = 0, igate = 0):
         return self._request_softnic('connect_modules', 
-                {'m1': m1, 'm2': m2, 'gate': gate})
+                {'m1': m1, 'm2': m2, 'gate': gate, 'igate': igate})
 
     def disconnect_modules(self, name, gate = 0):
         return self._request_softnic('disconnect_modules', 
@@ -203,6 +203,15 @@ class SoftNIC(object):
         args = {'wid': wid, 'core': core}
         return self._request_softnic('add_worker', args)
 
+    def set_worker_idle(self, wid, mode, sleep_rounds=None,
+                        max_sleep_us=None):
+        args = {'wid': wid, 'mode': mode}
+        if sleep_rounds is not None:
+            args['sleep_rounds'] = sleep_rounds
+        if max_sleep_us is not None:
+            args['max_sleep_us'] = max_sleep_us
+        return self._request_softnic('set_worker_idle', args)
+
     def attach_task(self, m, tid, tc=None, wid=None):
         if (tc is None) == (wid is None):
             raise self.APIError('You should specify either "tc" or "wid"' \
@@ -223,13 +232,34 @@ class SoftNIC(object):
         return self._request_softnic('list_tcs', args)
 
     def add_tc(self, c, wid=0, priority=0, 
-            limit_sps=0, limit_cps=0, limit_pps=0, limit_bps=0):
+            limit_sps=0, limit_cps=0, limit_pps=0, limit_bps=0,
+            migratable=0, target_latency_ns=0,
+            policy='stride', period_ns=0,
+            quantum_tasks=0, quantum_ns=0):
         args = {'name': c, 'wid': wid, 'priority': priority, 
+                'migratable': migratable,
+                'target_latency_ns': target_latency_ns,
+                'policy': policy,
+                'period_ns': period_ns,
+                'quantum_tasks': quantum_tasks,
+                'quantum_ns': quantum_ns,
                 'limit_sps': limit_sps, 
                 'limit_cps': limit_cps, 
                 'limit_pps': limit_pps, 
                 'limit_bps': limit_bps}
         return self._request_softnic('add_tc', args)
 
+    def enable_profile(self, one_in):
+        return self._request_softnic('enable_profile', {'one_in': one_in})
+
+    def get_profile(self):
+        return self._request_softnic('get_profile')
+
     def get_tc_stats(self, name):
         return self._request_softnic('get_tc_stats', name)
+
+    def get_all_tc_stats(self):
+        return self._request_softnic('get_tc_stats')
+
+    def migrate_tc(self, name, wid):
+        return self._request_softnic('migrate_tc', {'name': name, 'wid': wid})